@@ -1262,6 +1262,11 @@ BASE_FEATURE(kKeepAliveInBrowserMigration,
 
 // Enables the JPEG XL Image File Format (JXL).
 BASE_FEATURE(kJXL, "JXL", base::FEATURE_ENABLED_BY_DEFAULT);
+BASE_FEATURE_PARAM(int,
+                   kJXLDecoderMemoryLimitMultiplier,
+                   &kJXL,
+                   "decoder-memory-limit-multiplier",
+                   8);
 
 BASE_FEATURE(kAttributionReportingInBrowserMigration,
              "AttributionReportingInBrowserMigration",
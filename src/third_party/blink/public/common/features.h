@@ -723,6 +723,11 @@ BLINK_COMMON_EXPORT extern const char
     kIntensiveWakeUpThrottling_GracePeriodSeconds_Name[];
 
 BLINK_COMMON_EXPORT BASE_DECLARE_FEATURE(kJXL);
+// Multiple of the decoded image byte limit that libjxl may allocate for its
+// internal buffers before a JXL decode is failed.
+BLINK_COMMON_EXPORT BASE_DECLARE_FEATURE_PARAM(
+    int,
+    kJXLDecoderMemoryLimitMultiplier);
 
 // Don't require FCP for the page to turn interactive. Useful for testing.
 BLINK_COMMON_EXPORT BASE_DECLARE_FEATURE(kInteractiveDetectorIgnoreFcp);
@@ -330,7 +330,7 @@ std::unique_ptr<ImageDecoder> ImageDecoder::CreateByMimeType(
   } else if (base::FeatureList::IsEnabled(features::kJXL) &&
              mime_type == "image/jxl") {
     decoder = std::make_unique<JXLImageDecoder>(
-        alpha_option, high_bit_depth_decoding_option, color_behavior,
+        alpha_option, high_bit_depth_decoding_option, color_behavior, aux_image,
         max_decoded_bytes, animation_option);
 #endif
   }
@@ -0,0 +1,188 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_color_profile_cache.h"
+
+#include <string.h>
+
+#include <utility>
+
+#include "base/containers/heap_array.h"
+#include "base/hash/hash.h"
+#include "third_party/blink/renderer/platform/image-decoders/image_decoder.h"
+#include "third_party/skia/include/core/SkColorSpace.h"
+#include "ui/gfx/color_space.h"
+
+#ifdef UNSAFE_BUFFERS_BUILD
+// TODO(crbug.com/351564777): Remove this and convert code to safer constructs.
+#pragma allow_unsafe_buffers
+#endif
+
+namespace blink {
+
+namespace {
+
+// Returns transfer function which approximates HLG with linear range 0..1,
+// while skcms_TransferFunction_makeHLGish uses linear range 0..12.
+void MakeTransferFunctionHLG01(skcms_TransferFunction* tf) {
+  skcms_TransferFunction_makeScaledHLGish(
+      tf, 1 / 12.0f, 2.0f, 2.0f, 1 / 0.17883277f, 0.28466892f, 0.55991073f);
+}
+
+// The input profile must outlive the output one as they will share their
+// buffers.
+skcms_ICCProfile ReplaceTransferFunction(skcms_ICCProfile profile,
+                                         const skcms_TransferFunction& tf) {
+  // Override the transfer function with a known parametric curve.
+  profile.has_trc = true;
+  for (int c = 0; c < 3; c++) {
+    profile.trc[c].table_entries = 0;
+    profile.trc[c].parametric = tf;
+  }
+  return profile;
+}
+
+// Computes whether the transfer function from the ColorProfile, that was
+// created from a parsed ICC profile, approximately matches the given parametric
+// transfer function.
+bool ApproximatelyMatchesTF(const ColorProfile& profile,
+                            const skcms_TransferFunction& tf) {
+  skcms_ICCProfile parsed_copy =
+      ReplaceTransferFunction(*profile.GetProfile(), tf);
+  return skcms_ApproximatelyEqualProfiles(profile.GetProfile(), &parsed_copy);
+}
+
+}  // namespace
+
+// static
+JXLColorProfileCache& JXLColorProfileCache::Get() {
+  static base::NoDestructor<JXLColorProfileCache> cache;
+  return *cache;
+}
+
+JXLColorProfileCache::JXLColorProfileCache() {
+  base::AutoLock lock(lock_);
+  entries_.reserve(kMaxEntries);
+}
+
+JXLColorProfileCache::~JXLColorProfileCache() = default;
+
+std::unique_ptr<ColorProfile> JXLColorProfileCache::GetProfile(
+    base::span<const uint8_t> icc,
+    bool* is_hdr) {
+  if (icc.size() > kMaxCachedProfileSize) {
+    // Parsed again for every image that uses it.
+    Entry entry = MakeEntry(0, icc);
+    if (!entry.parsed) {
+      return nullptr;
+    }
+    *is_hdr = entry.is_hdr;
+    return MakeUncachedProfile(std::move(entry));
+  }
+
+  const size_t hash = base::FastHash(icc);
+  {
+    base::AutoLock lock(lock_);
+    if (const Entry* entry = Find(hash, icc)) {
+      *is_hdr = entry->is_hdr;
+      return std::make_unique<ColorProfile>(entry->profile);
+    }
+  }
+
+  // Parsing is done without holding the lock, so that decoders on other
+  // threads are not held up.
+  Entry entry = MakeEntry(hash, icc);
+  if (!entry.parsed) {
+    return nullptr;
+  }
+  *is_hdr = entry.is_hdr;
+
+  base::AutoLock lock(lock_);
+  if (const Entry* cached = Find(hash, icc)) {
+    // Another decoder added the profile meanwhile.
+    return std::make_unique<ColorProfile>(cached->profile);
+  }
+  if (entries_.size() < kMaxEntries) {
+    auto profile = std::make_unique<ColorProfile>(entry.profile);
+    entries_.push_back(std::move(entry));
+    return profile;
+  }
+  return MakeUncachedProfile(std::move(entry));
+}
+
+// static
+std::unique_ptr<ColorProfile> JXLColorProfileCache::MakeUncachedProfile(
+    Entry entry) {
+  // An HDR profile points into the buffer of the parsed one, but with another
+  // transfer function, so it needs a buffer of its own.
+  if (!entry.is_hdr) {
+    return std::move(entry.parsed);
+  }
+  const skcms_ICCProfile* parsed = entry.parsed->GetProfile();
+  auto buffer = base::HeapArray<uint8_t>::CopiedFrom(
+      base::span(parsed->buffer, parsed->size));
+  skcms_ICCProfile profile;
+  if (!skcms_Parse(buffer.data(), buffer.size(), &profile)) {
+    return nullptr;
+  }
+  return std::make_unique<ColorProfile>(
+      ReplaceTransferFunction(profile, entry.profile.trc[0].parametric),
+      std::move(buffer));
+}
+
+// static
+JXLColorProfileCache::Entry JXLColorProfileCache::MakeEntry(
+    size_t hash,
+    base::span<const uint8_t> icc) {
+  Entry entry{hash, ColorProfile::Create(icc), skcms_ICCProfile(), false};
+  if (!entry.parsed) {
+    return entry;
+  }
+  entry.profile = *entry.parsed->GetProfile();
+
+  // Detect whether the ICC profile approximately equals PQ or HLG, and set
+  // the profile to one that indicates this transfer function more clearly
+  // than a raw ICC profile does, so Chrome considers the profile as HDR.
+  skcms_TransferFunction tf_pq;
+  skcms_TransferFunction tf_hlg01;
+  skcms_TransferFunction tf_hlg12;
+  skcms_TransferFunction_makePQ(&tf_pq);
+  MakeTransferFunctionHLG01(&tf_hlg01);
+  skcms_TransferFunction_makeHLG(&tf_hlg12);
+
+  if (ApproximatelyMatchesTF(*entry.parsed, tf_pq)) {
+    entry.is_hdr = true;
+    auto hdr10 = gfx::ColorSpace::CreateHDR10().ToSkColorSpace();
+    skcms_TransferFunction pq;
+    hdr10->transferFn(&pq);
+    entry.profile = ReplaceTransferFunction(entry.profile, pq);
+  } else {
+    for (skcms_TransferFunction tf : {tf_hlg01, tf_hlg12}) {
+      if (ApproximatelyMatchesTF(*entry.parsed, tf)) {
+        entry.is_hdr = true;
+        auto hlg_colorspace = gfx::ColorSpace::CreateHLG().ToSkColorSpace();
+        skcms_TransferFunction hlg;
+        hlg_colorspace->transferFn(&hlg);
+        entry.profile = ReplaceTransferFunction(entry.profile, hlg);
+        break;
+      }
+    }
+  }
+  return entry;
+}
+
+const JXLColorProfileCache::Entry* JXLColorProfileCache::Find(
+    size_t hash,
+    base::span<const uint8_t> icc) const {
+  for (const Entry& entry : entries_) {
+    const skcms_ICCProfile* parsed = entry.parsed->GetProfile();
+    if (entry.hash == hash && parsed->size == icc.size() &&
+        !memcmp(parsed->buffer, icc.data(), icc.size())) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace blink
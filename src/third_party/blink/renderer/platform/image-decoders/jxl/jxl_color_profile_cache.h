@@ -0,0 +1,80 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_COLOR_PROFILE_CACHE_H_
+#define THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_COLOR_PROFILE_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "base/containers/span.h"
+#include "base/no_destructor.h"
+#include "base/synchronization/lock.h"
+#include "base/thread_annotations.h"
+#include "third_party/blink/renderer/platform/platform_export.h"
+#include "third_party/blink/renderer/platform/wtf/vector.h"
+#include "third_party/skia/modules/skcms/skcms.h"
+
+namespace blink {
+
+class ColorProfile;
+
+// Remembers the ICC profiles of JXL images once parsed and checked for HDR
+// transfer functions, because pages tend to use the same few profiles for
+// all their images. Shared by the decoders of all threads.
+//
+// The profiles handed out point into the cached buffers, so entries are
+// never evicted. Once the cache is full, further profiles are handled
+// without it. So are profiles larger than kMaxCachedProfileSize, such as
+// those with lookup tables, which are rarely shared and would pin too much
+// memory.
+class PLATFORM_EXPORT JXLColorProfileCache {
+ public:
+  static constexpr wtf_size_t kMaxEntries = 32;
+  static constexpr size_t kMaxCachedProfileSize = 4 * 1024;
+
+  static JXLColorProfileCache& Get();
+
+  JXLColorProfileCache(const JXLColorProfileCache&) = delete;
+  JXLColorProfileCache& operator=(const JXLColorProfileCache&) = delete;
+
+  // Returns the profile described by `icc`. If its transfer function
+  // approximately matches PQ or HLG, it is replaced by the exact curve, so
+  // that the profile is recognized as HDR, and `is_hdr` is set to true.
+  // Returns nullptr if `icc` cannot be parsed.
+  std::unique_ptr<ColorProfile> GetProfile(base::span<const uint8_t> icc,
+                                           bool* is_hdr);
+
+ private:
+  friend class base::NoDestructor<JXLColorProfileCache>;
+
+  struct Entry {
+    size_t hash;
+    // Owns the buffer `profile` points into.
+    std::unique_ptr<ColorProfile> parsed;
+    skcms_ICCProfile profile;
+    bool is_hdr;
+  };
+
+  JXLColorProfileCache();
+  ~JXLColorProfileCache();
+
+  // Parses `icc` and classifies its transfer function.
+  static Entry MakeEntry(size_t hash, base::span<const uint8_t> icc);
+
+  // Returns the profile of `entry`, which is not cached, owning its buffer.
+  static std::unique_ptr<ColorProfile> MakeUncachedProfile(Entry entry);
+
+  const Entry* Find(size_t hash, base::span<const uint8_t> icc) const
+      EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  base::Lock lock_;
+  WTF::Vector<Entry> entries_ GUARDED_BY(lock_);
+};
+
+}  // namespace blink
+
+#endif  // THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_COLOR_PROFILE_CACHE_H_
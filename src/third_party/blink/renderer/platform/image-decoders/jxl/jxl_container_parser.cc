@@ -0,0 +1,154 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_container_parser.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "base/numerics/checked_math.h"
+#include "third_party/blink/renderer/platform/image-decoders/fast_shared_buffer_reader.h"
+
+#ifdef UNSAFE_BUFFERS_BUILD
+// TODO(crbug.com/351564777): Remove this and convert code to safer constructs.
+#pragma allow_unsafe_buffers
+#endif
+
+namespace blink {
+
+namespace {
+
+uint64_t ReadBigEndian(const uint8_t* data, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; ++i) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+// The index that precedes the codestream in the payload of a `jxlp` box.
+constexpr size_t kPartialCodestreamIndexSize = 4;
+
+}  // namespace
+
+bool JXLContainerParser::Update(const FastSharedBufferReader& reader) {
+  const size_t data_size = reader.size();
+  char buffer[16];
+  if (format_ == Format::kUnknown) {
+    if (data_size >= 2 &&
+        !memcmp(reader.GetConsecutiveData(0, 2, buffer), "\xFF\x0A", 2)) {
+      format_ = Format::kCodestream;
+    } else if (data_size < kSignatureSize) {
+      return true;
+    } else if (!memcmp(reader.GetConsecutiveData(0, kSignatureSize, buffer),
+                       kSignature, kSignatureSize)) {
+      format_ = Format::kContainer;
+      next_box_offset_ = kSignatureSize;
+    } else {
+      // Not JXL. libjxl reports the error.
+      format_ = Format::kCodestream;
+    }
+    if (format_ == Format::kCodestream) {
+      codestream_parts_.push_back(CodestreamPart{0, 0, kToEndOfData});
+      last_box_seen_ = true;
+    }
+  }
+
+  // A box may end beyond the data received so far, and `next_box_offset_`
+  // with it.
+  while (!last_box_seen_ && next_box_offset_ <= data_size &&
+         data_size - next_box_offset_ >= 8) {
+    const uint8_t* header = reinterpret_cast<const uint8_t*>(
+        reader.GetConsecutiveData(next_box_offset_, 8, buffer));
+    uint64_t box_size = ReadBigEndian(header, 4);
+    char box_type[4];
+    memcpy(box_type, header + 4, sizeof(box_type));
+    size_t header_size = 8;
+    if (box_size == 1) {
+      // 64-bit size, following the type.
+      if (next_box_offset_ > data_size ||
+          data_size - next_box_offset_ < 16) {
+        return true;
+      }
+      header = reinterpret_cast<const uint8_t*>(
+          reader.GetConsecutiveData(next_box_offset_, 16, buffer));
+      box_size = ReadBigEndian(header + 8, 8);
+      header_size = 16;
+    }
+
+    const size_t payload_offset = next_box_offset_ + header_size;
+    size_t payload_size = kToEndOfData;
+    if (box_size == 0) {
+      // The box extends to the end of the data.
+      last_box_seen_ = true;
+    } else if (box_size < header_size ||
+               !base::CheckAdd(next_box_offset_, box_size)
+                    .AssignIfValid(&next_box_offset_)) {
+      return false;
+    } else {
+      payload_size = static_cast<size_t>(box_size) - header_size;
+    }
+
+    if (!memcmp(box_type, "jxlc", 4) || !memcmp(box_type, "jxlp", 4)) {
+      CodestreamPart part{payload_offset, codestream_size_, payload_size};
+      if (box_type[3] == 'p') {
+        if (payload_size < kPartialCodestreamIndexSize) {
+          return false;
+        }
+        part.data_offset += kPartialCodestreamIndexSize;
+        if (payload_size != kToEndOfData) {
+          part.size -= kPartialCodestreamIndexSize;
+        }
+      }
+      codestream_parts_.push_back(part);
+      codestream_size_ = part.size == kToEndOfData
+                             ? kToEndOfData
+                             : codestream_size_ + part.size;
+    } else if (!memcmp(box_type, "Exif", 4) && !exif_box_) {
+      exif_box_ = Box{payload_offset, payload_size};
+    } else if (!memcmp(box_type, "jhgm", 4) && !gainmap_box_) {
+      gainmap_box_ = Box{payload_offset, payload_size};
+    }
+  }
+  return true;
+}
+
+size_t JXLContainerParser::AvailableCodestreamSize(size_t data_size) const {
+  size_t available = 0;
+  for (const CodestreamPart& part : codestream_parts_) {
+    if (data_size <= part.data_offset) {
+      break;
+    }
+    const size_t part_available =
+        std::min(part.size, data_size - part.data_offset);
+    available += part_available;
+    if (part_available < part.size) {
+      break;
+    }
+  }
+  return available;
+}
+
+size_t JXLContainerParser::GetSomeCodestreamData(
+    const FastSharedBufferReader& reader,
+    size_t position,
+    const char*& data) const {
+  for (const CodestreamPart& part : codestream_parts_) {
+    if (position - part.codestream_offset >= part.size) {
+      continue;
+    }
+    const size_t part_position = position - part.codestream_offset;
+    const size_t data_position = part.data_offset + part_position;
+    if (data_position >= reader.size()) {
+      return 0;
+    }
+    return std::min(reader.GetSomeData(data, data_position),
+                    part.size - part_position);
+  }
+  return 0;
+}
+
+}  // namespace blink
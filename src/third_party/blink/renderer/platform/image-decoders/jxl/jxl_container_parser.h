@@ -0,0 +1,85 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_CONTAINER_PARSER_H_
+#define THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_CONTAINER_PARSER_H_
+
+#include <stddef.h>
+
+#include <limits>
+#include <optional>
+
+#include "third_party/blink/renderer/platform/platform_export.h"
+#include "third_party/blink/renderer/platform/wtf/vector.h"
+
+namespace blink {
+
+class FastSharedBufferReader;
+
+// Follows the boxes of a JXL container, see ISO/IEC 18181-2, as its data
+// arrives, so that libjxl can be handed the codestream alone. Other boxes,
+// such as Exif, XMP or JUMBF metadata, are skipped by offset without being
+// read. Only the positions of the boxes Blink uses are recorded. Data that
+// is not a container is treated as a bare codestream.
+class PLATFORM_EXPORT JXLContainerParser {
+ public:
+  static constexpr char kSignature[] = "\0\0\0\x0CJXL \x0D\x0A\x87\x0A";
+  static constexpr size_t kSignatureSize = 12;
+
+  // The size of a box that extends to the end of the data.
+  static constexpr size_t kToEndOfData = std::numeric_limits<size_t>::max();
+
+  // The position of the payload of a box in the data.
+  struct Box {
+    size_t offset = 0;
+    size_t size = 0;
+  };
+
+  JXLContainerParser() = default;
+  JXLContainerParser(const JXLContainerParser&) = delete;
+  JXLContainerParser& operator=(const JXLContainerParser&) = delete;
+  ~JXLContainerParser() = default;
+
+  // Parses the box headers that arrived since the last call. `reader` must
+  // hold the same data as in earlier calls, possibly followed by more.
+  // Returns false if the container is invalid.
+  bool Update(const FastSharedBufferReader& reader);
+
+  // Returns the number of consecutive codestream bytes among the first
+  // `data_size` bytes of the data.
+  size_t AvailableCodestreamSize(size_t data_size) const;
+
+  // Points `data` at the codestream from `position` on, and returns how many
+  // consecutive bytes `reader` has there, without copying. Returns 0 if none
+  // are available yet.
+  size_t GetSomeCodestreamData(const FastSharedBufferReader& reader,
+                               size_t position,
+                               const char*& data) const;
+
+  // The payloads of the first `Exif` and `jhgm` boxes seen so far.
+  const std::optional<Box>& exif_box() const { return exif_box_; }
+  const std::optional<Box>& gainmap_box() const { return gainmap_box_; }
+
+ private:
+  enum class Format { kUnknown, kCodestream, kContainer };
+
+  // A run of the codestream, from a `jxlc` or `jxlp` box.
+  struct CodestreamPart {
+    size_t data_offset;
+    size_t codestream_offset;
+    size_t size;
+  };
+
+  Format format_ = Format::kUnknown;
+  size_t next_box_offset_ = 0;
+  bool last_box_seen_ = false;
+  size_t codestream_size_ = 0;
+  WTF::Vector<CodestreamPart> codestream_parts_;
+  std::optional<Box> exif_box_;
+  std::optional<Box> gainmap_box_;
+};
+
+}  // namespace blink
+
+#endif  // THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_CONTAINER_PARSER_H_
@@ -0,0 +1,281 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_frame_encoding.h"
+
+#include <stddef.h>
+
+#ifdef UNSAFE_BUFFERS_BUILD
+// TODO(crbug.com/351564777): Remove this and convert code to safer constructs.
+#pragma allow_unsafe_buffers
+#endif
+
+namespace blink {
+
+namespace {
+
+// The field encodings of ISO/IEC 18181-1. A U32 field selects one of four
+// distributions with its first two bits, each an offset plus a number of
+// further bits.
+struct U32Distribution {
+  uint32_t bits[4];
+  uint32_t offsets[4];
+};
+
+constexpr U32Distribution kEnum = {{0, 0, 4, 6}, {0, 1, 2, 18}};
+constexpr U32Distribution kImageDimension = {{9, 13, 18, 30}, {1, 1, 1, 1}};
+constexpr U32Distribution kBitsPerSample = {{0, 0, 0, 6}, {8, 10, 12, 1}};
+constexpr U32Distribution kFloatBitsPerSample = {{0, 0, 0, 6},
+                                                 {32, 16, 24, 1}};
+constexpr U32Distribution kNumExtraChannels = {{0, 0, 4, 12}, {0, 1, 2, 1}};
+constexpr U32Distribution kCustomXY = {{19, 19, 20, 21},
+                                       {0, 524288, 1048576, 2097152}};
+constexpr U32Distribution kFrameType = {{0, 0, 0, 0}, {0, 1, 2, 3}};
+constexpr U32Distribution kUpsampling = {{0, 0, 0, 0}, {1, 2, 4, 8}};
+constexpr U32Distribution kNumPasses = {{0, 0, 0, 3}, {1, 2, 3, 4}};
+constexpr U32Distribution kNumDownsample = {{0, 0, 0, 1}, {0, 1, 2, 3}};
+constexpr U32Distribution kDownsample = {{0, 0, 0, 0}, {1, 2, 4, 8}};
+constexpr U32Distribution kLastPass = {{0, 0, 0, 3}, {0, 1, 2, 0}};
+constexpr U32Distribution kBlendMode = {{0, 0, 0, 2}, {0, 1, 2, 3}};
+
+constexpr uint32_t kColorSpaceGray = 1;
+constexpr uint32_t kColorSpaceXYB = 2;
+constexpr uint32_t kCustomWhitePointOrPrimaries = 2;
+constexpr uint64_t kUseDcFrameFlag = 32;
+
+// Reads the bits of the codestream, least significant first. Reading past
+// the end fails the reader, after which every read returns zero.
+class BitReader {
+ public:
+  explicit BitReader(base::span<const uint8_t> data) : data_(data) {}
+
+  bool ok() const { return ok_; }
+
+  uint32_t ReadBits(uint32_t num_bits) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < num_bits; ++i) {
+      if (position_ >= data_.size() * 8) {
+        ok_ = false;
+        return 0;
+      }
+      value |= ((data_[position_ / 8] >> (position_ % 8)) & 1u) << i;
+      ++position_;
+    }
+    return value;
+  }
+
+  bool ReadBool() { return ReadBits(1); }
+
+  uint32_t ReadU32(const U32Distribution& distribution) {
+    const uint32_t selector = ReadBits(2);
+    return distribution.offsets[selector] +
+           ReadBits(distribution.bits[selector]);
+  }
+
+  uint64_t ReadU64() {
+    switch (ReadBits(2)) {
+      case 0:
+        return 0;
+      case 1:
+        return 1 + ReadBits(4);
+      case 2:
+        return 17 + ReadBits(8);
+      default: {
+        uint64_t value = ReadBits(12);
+        for (uint32_t shift = 12; ReadBool() && ok_; shift += 8) {
+          if (shift == 60) {
+            value |= uint64_t{ReadBits(4)} << shift;
+            break;
+          }
+          value |= uint64_t{ReadBits(8)} << shift;
+        }
+        return value;
+      }
+    }
+  }
+
+  uint32_t ReadEnum() { return ReadU32(kEnum); }
+
+  void SkipF16(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      ReadBits(16);
+    }
+  }
+
+  void JumpToByteBoundary() { position_ = (position_ + 7) / 8 * 8; }
+
+ private:
+  base::span<const uint8_t> data_;
+  size_t position_ = 0;
+  bool ok_ = true;
+};
+
+void SkipSizeHeader(BitReader& reader) {
+  const bool small = reader.ReadBool();
+  if (small) {
+    reader.ReadBits(5);
+  } else {
+    reader.ReadU32(kImageDimension);
+  }
+  if (reader.ReadBits(3) == 0) {
+    if (small) {
+      reader.ReadBits(5);
+    } else {
+      reader.ReadU32(kImageDimension);
+    }
+  }
+}
+
+void SkipCustomXY(BitReader& reader) {
+  reader.ReadU32(kCustomXY);
+  reader.ReadU32(kCustomXY);
+}
+
+// Returns false if the color encoding is an ICC profile, which is entropy
+// coded and so has no size known from the headers.
+bool SkipColorEncoding(BitReader& reader) {
+  if (reader.ReadBool()) {
+    return true;
+  }
+  if (reader.ReadBool()) {
+    return false;
+  }
+  const uint32_t color_space = reader.ReadEnum();
+  if (color_space != kColorSpaceXYB) {
+    if (reader.ReadEnum() == kCustomWhitePointOrPrimaries) {
+      SkipCustomXY(reader);
+    }
+  }
+  if (color_space != kColorSpaceGray && color_space != kColorSpaceXYB) {
+    if (reader.ReadEnum() == kCustomWhitePointOrPrimaries) {
+      for (int i = 0; i < 3; ++i) {
+        SkipCustomXY(reader);
+      }
+    }
+  }
+  if (color_space != kColorSpaceXYB) {
+    if (reader.ReadBool()) {
+      reader.ReadBits(24);
+    } else {
+      reader.ReadEnum();
+    }
+  }
+  reader.ReadEnum();
+  return true;
+}
+
+// Reads the image headers up to the first frame header. Returns false if
+// that is not possible, or if the image is not XYB encoded.
+bool SkipImageHeaders(BitReader& reader) {
+  if (reader.ReadBits(16) != 0x0AFF) {
+    return false;
+  }
+  SkipSizeHeader(reader);
+  // All defaults means an 8-bit XYB image without extra channels.
+  if (!reader.ReadBool()) {
+    const bool extra_fields = reader.ReadBool();
+    if (extra_fields) {
+      reader.ReadBits(3);
+      if (reader.ReadBool()) {
+        SkipSizeHeader(reader);
+      }
+      // A preview frame precedes the image, an animation has several frames.
+      if (reader.ReadBool() || reader.ReadBool()) {
+        return false;
+      }
+    }
+    if (reader.ReadBool()) {
+      reader.ReadU32(kFloatBitsPerSample);
+      reader.ReadBits(4);
+    } else {
+      reader.ReadU32(kBitsPerSample);
+    }
+    reader.ReadBool();
+    if (reader.ReadU32(kNumExtraChannels) != 0) {
+      return false;
+    }
+    if (!reader.ReadBool()) {
+      return false;
+    }
+    if (!SkipColorEncoding(reader)) {
+      return false;
+    }
+    if (extra_fields && !reader.ReadBool()) {
+      // The tone mapping fields.
+      reader.SkipF16(2);
+      reader.ReadBool();
+      reader.SkipF16(1);
+    }
+    if (reader.ReadU64() != 0) {
+      return false;
+    }
+  }
+  // The custom transform data.
+  if (!reader.ReadBool()) {
+    if (!reader.ReadBool()) {
+      // The opsin inverse matrix, its bias and the quantization bias.
+      reader.SkipF16(16);
+    }
+    const uint32_t custom_weights_mask = reader.ReadBits(3);
+    if (custom_weights_mask & 1) {
+      reader.SkipF16(15);
+    }
+    if (custom_weights_mask & 2) {
+      reader.SkipF16(55);
+    }
+    if (custom_weights_mask & 4) {
+      reader.SkipF16(210);
+    }
+  }
+  reader.JumpToByteBoundary();
+  return reader.ok();
+}
+
+}  // namespace
+
+bool IsSingleVarDCTFrame(base::span<const uint8_t> codestream) {
+  BitReader reader(codestream);
+  if (!SkipImageHeaders(reader)) {
+    return false;
+  }
+  // All defaults means the last frame, a VarDCT one covering the canvas.
+  if (reader.ReadBool()) {
+    return reader.ok();
+  }
+  const uint32_t frame_type = reader.ReadU32(kFrameType);
+  const bool modular = reader.ReadBool();
+  if (frame_type != 0 || modular) {
+    return false;
+  }
+  const uint64_t flags = reader.ReadU64();
+  if (!(flags & kUseDcFrameFlag)) {
+    reader.ReadU32(kUpsampling);
+  }
+  // The quantization matrix scales of XYB images.
+  reader.ReadBits(6);
+  const uint32_t num_passes = reader.ReadU32(kNumPasses);
+  if (num_passes != 1) {
+    const uint32_t num_downsample = reader.ReadU32(kNumDownsample);
+    for (uint32_t i = 0; i + 1 < num_passes; ++i) {
+      reader.ReadBits(2);
+    }
+    for (uint32_t i = 0; i < num_downsample; ++i) {
+      reader.ReadU32(kDownsample);
+    }
+    for (uint32_t i = 0; i < num_downsample; ++i) {
+      reader.ReadU32(kLastPass);
+    }
+  }
+  // A frame with a custom size or origin does not cover the whole canvas.
+  if (reader.ReadBool()) {
+    return false;
+  }
+  if (reader.ReadU32(kBlendMode) != 0) {
+    reader.ReadBits(2);
+  }
+  const bool is_last = reader.ReadBool();
+  return reader.ok() && is_last;
+}
+
+}  // namespace blink
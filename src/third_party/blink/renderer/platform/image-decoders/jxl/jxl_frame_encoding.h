@@ -0,0 +1,27 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_FRAME_ENCODING_H_
+#define THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_FRAME_ENCODING_H_
+
+#include <stdint.h>
+
+#include "base/containers/span.h"
+#include "third_party/blink/renderer/platform/platform_export.h"
+
+namespace blink {
+
+// Returns true if the JXL `codestream`, of which at least the headers up to
+// the first frame header must be given, is an XYB image made of a single
+// VarDCT frame covering the canvas. The DC image of such a frame averages its
+// 8x8 blocks, which libjxl does not report.
+//
+// Returns false if the image is anything else, or if that cannot be told
+// from the headers without decoding them, such as when an ICC profile, a
+// preview or extra channels precede the frame.
+PLATFORM_EXPORT bool IsSingleVarDCTFrame(base::span<const uint8_t> codestream);
+
+}  // namespace blink
+
+#endif  // THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_FRAME_ENCODING_H_
@@ -3,10 +3,24 @@
 // found in the LICENSE file.
 
 #include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_image_decoder.h"
+
+#include <algorithm>
+#include <limits>
+
 #include "base/logging.h"
+#include "base/notreached.h"
+#include "base/numerics/clamped_math.h"
+#include "base/numerics/safe_conversions.h"
 #include "base/time/time.h"
+#include "third_party/blink/public/common/features.h"
 #include "third_party/blink/renderer/platform/image-decoders/fast_shared_buffer_reader.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_color_profile_cache.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_frame_encoding.h"
+#include "third_party/blink/renderer/platform/image-decoders/segment_reader.h"
+#include "third_party/blink/renderer/platform/wtf/wtf.h"
 #include "third_party/skia/include/core/SkColorSpace.h"
+#include "third_party/skia/include/core/SkData.h"
+#include "third_party/skia/include/private/SkGainmapInfo.h"
 
 #ifdef UNSAFE_BUFFERS_BUILD
 // TODO(crbug.com/351564777): Remove this and convert code to safer constructs.
@@ -16,46 +30,232 @@
 namespace blink {
 
 namespace {
-// Returns transfer function which approximates HLG with linear range 0..1,
-// while skcms_TransferFunction_makeHLGish uses linear range 0..12.
-void MakeTransferFunctionHLG01(skcms_TransferFunction* tf) {
-  skcms_TransferFunction_makeScaledHLGish(
-      tf, 1 / 12.0f, 2.0f, 2.0f, 1 / 0.17883277f, 0.28466892f, 0.55991073f);
-}
-
-// The input profile must outlive the output one as they will share their
-// buffers.
-skcms_ICCProfile ReplaceTransferFunction(skcms_ICCProfile profile,
-                                         const skcms_TransferFunction& tf) {
-  // Override the transfer function with a known parametric curve.
-  profile.has_trc = true;
-  for (int c = 0; c < 3; c++) {
-    profile.trc[c].table_entries = 0;
-    profile.trc[c].parametric = tf;
-  }
-  return profile;
-}
-
-// Computes whether the transfer function from the ColorProfile, that was
-// created from a parsed ICC profile, approximately matches the given parametric
-// transfer function.
-bool ApproximatelyMatchesTF(const ColorProfile& profile,
-                            const skcms_TransferFunction& tf) {
-  skcms_ICCProfile parsed_copy =
-      ReplaceTransferFunction(*profile.GetProfile(), tf);
-  return skcms_ApproximatelyEqualProfiles(profile.GetProfile(), &parsed_copy);
-}
-
-std::unique_ptr<ColorProfile> NewColorProfileWithSameBuffer(
-    const ColorProfile& buffer_donor,
-    skcms_ICCProfile new_profile) {
-  // The input ColorProfile owns the buffer memory, make a new copy for
-  // the newly created one and pass the ownership of the new copy to the new
-  // color profile.
-  base::HeapArray<uint8_t> owned_buffer=base::HeapArray<uint8_t>::Uninit(buffer_donor.GetProfile()->size);
-  memcpy(owned_buffer.data(), buffer_donor.GetProfile()->buffer, buffer_donor.GetProfile()->size);
-  new_profile.buffer = owned_buffer.data();
-  return std::make_unique<ColorProfile>(new_profile, std::move(owned_buffer));
+// Factor by which still images can be downscaled while decoding, the size of
+// the blocks the DC image of VarDCT averages.
+constexpr unsigned kDownscaleFactor = 8;
+
+// Downscaled decoding is only offered for images where it saves enough to be
+// worth it.
+constexpr uint32_t kMinDimensionForDownscaledDecode = 256;
+
+uint32_t ScaleDimension(uint32_t dimension, unsigned scale_denominator) {
+  return (dimension + scale_denominator - 1) / scale_denominator;
+}
+
+// Returns the skcms format matching the pixels libjxl produces for `format`.
+// skcms only reads gray pixels as 8-bit samples.
+skcms_PixelFormat SkcmsPixelFormat(const JxlPixelFormat& format) {
+  const uint32_t channels = format.num_channels;
+  DCHECK(channels == 4 || channels == 3 ||
+         (channels == 1 && format.data_type == JXL_TYPE_UINT8));
+  switch (format.data_type) {
+    case JXL_TYPE_UINT8:
+      return channels == 4   ? skcms_PixelFormat_RGBA_8888
+             : channels == 3 ? skcms_PixelFormat_RGB_888
+                             : skcms_PixelFormat_G_8;
+    case JXL_TYPE_FLOAT16:
+      return channels == 4 ? skcms_PixelFormat_RGBA_hhhh
+                           : skcms_PixelFormat_RGB_hhh;
+    case JXL_TYPE_FLOAT:
+      return channels == 4 ? skcms_PixelFormat_RGBA_ffff
+                           : skcms_PixelFormat_RGB_fff;
+    default:
+      NOTREACHED();
+  }
+}
+
+size_t BytesPerPixel(const JxlPixelFormat& format) {
+  switch (format.data_type) {
+    case JXL_TYPE_UINT8:
+      return format.num_channels;
+    case JXL_TYPE_FLOAT16:
+      return format.num_channels * 2;
+    case JXL_TYPE_FLOAT:
+      return format.num_channels * 4;
+    default:
+      NOTREACHED();
+  }
+}
+
+// libjxl needs tables and per-thread group buffers whatever the image size, so
+// small images get this much memory regardless of their output size.
+constexpr size_t kMinDecoderMemoryLimit = 64 * 1024 * 1024;
+// Frames whose planes take no more than this, such as those of a 512x512 image
+// with alpha, are decoded regardless of the output size limit.
+constexpr size_t kMinPlaneMemoryLimit = 4 * 1024 * 1024;
+
+// Rough compressed sizes of lossy and lossless JXL images, used to guess how
+// long the rest of an image takes to arrive.
+constexpr double kEstimatedLossyBytesPerPixel = 0.25;
+constexpr double kEstimatedLosslessBytesPerPixel = 1.0;
+
+// The arrival rate of the data is only trusted once it arrived over this
+// long.
+constexpr base::TimeDelta kMinRateMeasurementTime = base::Milliseconds(50);
+
+// Expected remaining load times from which intermediate renders are shown at
+// all, after the last pass of each resolution, and after every pass.
+constexpr base::TimeDelta kMinLoadTimeForProgression = base::Milliseconds(100);
+constexpr base::TimeDelta kMinLoadTimeForLastPasses = base::Milliseconds(500);
+constexpr base::TimeDelta kMinLoadTimeForPasses = base::Seconds(2);
+
+// Progression events are merged into one intermediate render per decode call,
+// and further apart than this unless the data grew by a quarter since the
+// last render.
+constexpr base::TimeDelta kMinFlushInterval = base::Milliseconds(200);
+constexpr size_t kMinFlushDataGrowthDivisor = 4;
+
+// Returns the primaries and white point of a color encoding of the
+// codestream.
+SkColorSpacePrimaries PrimariesFromEncoding(const JxlColorEncoding& encoding) {
+  SkColorSpacePrimaries primaries;
+  switch (encoding.primaries) {
+    case JXL_PRIMARIES_SRGB:
+      primaries = SkNamedPrimaries::kRec709;
+      break;
+    case JXL_PRIMARIES_2100:
+      primaries = SkNamedPrimaries::kRec2020;
+      break;
+    case JXL_PRIMARIES_P3:
+      primaries = SkNamedPrimaries::kSMPTE_EG_432_1;
+      break;
+    default:
+      primaries.fRX = encoding.primaries_red_xy[0];
+      primaries.fRY = encoding.primaries_red_xy[1];
+      primaries.fGX = encoding.primaries_green_xy[0];
+      primaries.fGY = encoding.primaries_green_xy[1];
+      primaries.fBX = encoding.primaries_blue_xy[0];
+      primaries.fBY = encoding.primaries_blue_xy[1];
+      break;
+  }
+  switch (encoding.white_point) {
+    case JXL_WHITE_POINT_D65:
+      primaries.fWX = 0.3127f;
+      primaries.fWY = 0.3290f;
+      break;
+    case JXL_WHITE_POINT_DCI:
+      primaries.fWX = 0.314f;
+      primaries.fWY = 0.351f;
+      break;
+    case JXL_WHITE_POINT_E:
+      primaries.fWX = 1.0f / 3;
+      primaries.fWY = 1.0f / 3;
+      break;
+    default:
+      primaries.fWX = encoding.white_point_xy[0];
+      primaries.fWY = encoding.white_point_xy[1];
+      break;
+  }
+  return primaries;
+}
+
+// JXL has no content light level or mastering display boxes. Its headers
+// bound the luminance of every pixel by intensity_target, and give the darkest
+// level of the mastering display as min_nits. The mastering display gamut is
+// only known when the color space is not an ICC profile.
+gfx::HDRMetadata MakeHDRMetadata(
+    const JxlBasicInfo& info,
+    const std::optional<JxlColorEncoding>& encoding) {
+  gfx::HDRMetadata metadata;
+  metadata.cta_861_3 = gfx::HdrMetadataCta861_3(
+      base::ClampRound<unsigned>(info.intensity_target), 0);
+  if (encoding) {
+    metadata.smpte_st_2086 = gfx::HdrMetadataSmpteSt2086(
+        PrimariesFromEncoding(*encoding), info.intensity_target,
+        info.min_nits);
+  }
+  return metadata;
+}
+
+uint64_t ReadBigEndian(const uint8_t* data, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; ++i) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+// Enough of the codestream for the image headers and the first frame header,
+// when their size is known without decoding them. See IsSingleVarDCTFrame().
+constexpr size_t kMaxCodestreamHeadersSize = 1024;
+
+// Returns the start of the codestream available in `reader`, up to
+// kMaxCodestreamHeadersSize bytes.
+WTF::Vector<uint8_t> CopyCodestreamHeaders(
+    const JXLContainerParser& container,
+    const FastSharedBufferReader& reader) {
+  const size_t size =
+      std::min(kMaxCodestreamHeadersSize,
+               container.AvailableCodestreamSize(reader.size()));
+  WTF::Vector<uint8_t> headers;
+  while (headers.size() < size) {
+    const char* data = nullptr;
+    const size_t read =
+        container.GetSomeCodestreamData(reader, headers.size(), data);
+    if (!read) {
+      break;
+    }
+    headers.Append(reinterpret_cast<const uint8_t*>(data),
+                   base::checked_cast<wtf_size_t>(
+                       std::min(read, size - headers.size())));
+  }
+  return headers;
+}
+
+sk_sp<SkData> CopyData(const FastSharedBufferReader& reader,
+                       size_t offset,
+                       size_t size) {
+  sk_sp<SkData> data = SkData::MakeUninitialized(size);
+  char* buffer = static_cast<char*>(data->writable_data());
+  const char* contents = reader.GetConsecutiveData(offset, size, buffer);
+  if (contents != buffer) {
+    memcpy(buffer, contents, size);
+  }
+  return data;
+}
+
+// Returns the number of bytes the planes libjxl decodes into may take for a
+// decoder whose output is limited to `max_decoded_bytes`, with
+// `max_decoded_bytes` the size of the full resolution image when the output is
+// downscaled. libjxl keeps several planes of float samples, so it needs a
+// multiple of the output size.
+size_t PlaneMemoryLimit(size_t max_decoded_bytes) {
+  if (max_decoded_bytes == ImageDecoder::kNoDecodedImageByteLimit) {
+    return std::numeric_limits<size_t>::max();
+  }
+  const int multiplier =
+      std::max(features::kJXLDecoderMemoryLimitMultiplier.Get(), 1);
+  return std::max(kMinPlaneMemoryLimit,
+                  base::ClampMul(max_decoded_bytes,
+                                 static_cast<size_t>(multiplier))
+                      .RawValue());
+}
+
+// Returns the number of bytes libjxl may allocate through the memory manager,
+// which also covers its tables and per-thread group buffers. libjxl 0.10 does
+// not allocate its planes through the memory manager yet, see
+// JXLMemoryManager, so those are checked against PlaneMemoryLimit() before
+// decoding a frame.
+size_t DecoderMemoryLimit(size_t max_decoded_bytes) {
+  return std::max(kMinDecoderMemoryLimit, PlaneMemoryLimit(max_decoded_bytes));
+}
+
+// Returns the bytes of the float planes libjxl decodes a frame with the header
+// `frame_header` into. Animation frames are blended onto a canvas of the image
+// size, which libjxl keeps as well.
+size_t FramePlaneBytes(const JxlBasicInfo& info,
+                       const JxlFrameHeader& frame_header) {
+  const size_t num_channels =
+      size_t{info.num_color_channels} + info.num_extra_channels;
+  base::ClampedNumeric<size_t> bytes =
+      base::ClampMul(size_t{frame_header.layer_info.xsize},
+                     frame_header.layer_info.ysize, num_channels,
+                     sizeof(float));
+  if (info.have_animation) {
+    bytes += base::ClampMul(size_t{info.xsize}, info.ysize, num_channels,
+                            sizeof(float));
+  }
+  return bytes;
 }
 }  // namespace
 
@@ -63,16 +263,502 @@ JXLImageDecoder::JXLImageDecoder(
     AlphaOption alpha_option,
     HighBitDepthDecodingOption high_bit_depth_decoding_option,
     const ColorBehavior& color_behavior,
+    cc::AuxImage aux_image,
     wtf_size_t max_decoded_bytes,
     AnimationOption animation_option)
     : ImageDecoder(alpha_option,
                    high_bit_depth_decoding_option,
                    color_behavior,
-                   cc::AuxImage::kDefault,
-                   max_decoded_bytes) {
+                   aux_image,
+                   max_decoded_bytes),
+      memory_manager_(DecoderMemoryLimit(max_decoded_bytes)),
+      plane_limit_bytes_(PlaneMemoryLimit(max_decoded_bytes)) {
   info_.have_animation = false;
 }
 
+JxlDecoderPtr JXLImageDecoder::CreateDecoder() {
+  JxlDecoderPtr dec = JxlDecoderMake(memory_manager_.get());
+  if (!dec) {
+    DVLOG(1) << "JxlDecoderMake failed";
+    SetFailed();
+  }
+  return dec;
+}
+
+Vector<SkISize> JXLImageDecoder::GetSupportedDecodeSizes() const {
+  if (!IsDecodedSizeAvailable() || !CanDecodeDownscaled()) {
+    return {};
+  }
+  return {SkISize::Make(ScaleDimension(info_.xsize, kDownscaleFactor),
+                        ScaleDimension(info_.ysize, kDownscaleFactor)),
+          SkISize::Make(info_.xsize, info_.ysize)};
+}
+
+gfx::Size JXLImageDecoder::DecodedSize() const {
+  if (scale_denominator_ == 1) {
+    return Size();
+  }
+  return gfx::Size(ScaleDimension(info_.xsize, scale_denominator_),
+                   ScaleDimension(info_.ysize, scale_denominator_));
+}
+
+bool JXLImageDecoder::GetGainmapInfoAndData(
+    SkGainmapInfo& out_gainmap_info,
+    scoped_refptr<SegmentReader>& out_gainmap_data) const {
+  // A gain map has no gain map of its own. The box may follow the codestream,
+  // so it is only looked for once the whole file is there.
+  if (aux_image_ != cc::AuxImage::kDefault || !IsAllDataReceived()) {
+    return false;
+  }
+  FastSharedBufferReader reader(data_.get());
+  JXLContainerParser container;
+  if (!container.Update(reader) || !container.gainmap_box()) {
+    return false;
+  }
+  const size_t box_offset = container.gainmap_box()->offset;
+  size_t box_size = container.gainmap_box()->size;
+  if (box_size == JXLContainerParser::kToEndOfData) {
+    box_size = reader.size() - box_offset;
+  } else if (box_size > reader.size() - box_offset) {
+    return false;
+  }
+  sk_sp<SkData> box = CopyData(reader, box_offset, box_size);
+  const uint8_t* bytes = box->bytes();
+
+  // The jhgm box holds, in order: a version byte, the ISO 21496-1 metadata
+  // preceded by its 16-bit size, a color encoding preceded by its 8-bit size,
+  // a compressed ICC profile preceded by its 32-bit size, and the codestream
+  // of the gain map.
+  size_t pos = 0;
+  if (box_size < 3 || bytes[pos] != 0) {
+    DVLOG(1) << "Unsupported jhgm box";
+    return false;
+  }
+  pos += 1;
+  const size_t metadata_size = ReadBigEndian(bytes + pos, 2);
+  pos += 2;
+  if (box_size - pos < metadata_size) {
+    return false;
+  }
+  const size_t metadata_offset = pos;
+  pos += metadata_size;
+  if (box_size - pos < 1) {
+    return false;
+  }
+  const size_t color_encoding_size = bytes[pos];
+  pos += 1;
+  if (box_size - pos < color_encoding_size) {
+    return false;
+  }
+  pos += color_encoding_size;
+  if (box_size - pos < 4) {
+    return false;
+  }
+  const uint64_t alt_icc_size = ReadBigEndian(bytes + pos, 4);
+  pos += 4;
+  if (box_size - pos < alt_icc_size) {
+    return false;
+  }
+  pos += static_cast<size_t>(alt_icc_size);
+  const size_t codestream_size = box_size - pos;
+  if (codestream_size < 2 || bytes[pos] != 0xFF || bytes[pos + 1] != 0x0A) {
+    DVLOG(1) << "jhgm box without a gain map codestream";
+    return false;
+  }
+
+  sk_sp<SkData> metadata =
+      SkData::MakeSubset(box.get(), metadata_offset, metadata_size);
+  if (!SkGainmapInfo::Parse(metadata.get(), out_gainmap_info)) {
+    DVLOG(1) << "Invalid gain map metadata";
+    return false;
+  }
+  // The gain map math then happens in the color space of the base image. The
+  // color encoding of the box is a JXL bundle, which only libjxl can read.
+  out_gainmap_info.fGainmapMathColorSpace = nullptr;
+  out_gainmap_data = SegmentReader::CreateFromSkData(
+      SkData::MakeSubset(box.get(), pos, codestream_size));
+  return true;
+}
+
+size_t JXLImageDecoder::NumDecodeThreads() const {
+  // Blocking on thread pool workers is not allowed on the main thread, so
+  // decodes there always stay on the calling thread.
+  if (IsMainThread()) {
+    return 1;
+  }
+  return JXLParallelRunner::NumThreadsForImageSize(info_.xsize, info_.ysize);
+}
+
+bool JXLImageDecoder::CanDecodeDownscaled() const {
+  return !info_.have_animation &&
+         info_.xsize >= kMinDimensionForDownscaledDecode &&
+         info_.ysize >= kMinDimensionForDownscaledDecode;
+}
+
+void JXLImageDecoder::UpdateScaleDenominator() {
+  scale_denominator_ = 1;
+  if (!CanDecodeDownscaled()) {
+    return;
+  }
+  const size_t bytes_per_pixel =
+      high_bit_depth_decoding_option_ == kHighBitDepthToHalfFloat ? 8 : 4;
+  const size_t full_size_bytes = base::ClampMul(
+      base::saturated_cast<size_t>(Size().Area64()), bytes_per_pixel);
+  if (full_size_bytes <= max_decoded_bytes_) {
+    return;
+  }
+  scale_denominator_ = kDownscaleFactor;
+  // libjxl still decodes at full resolution, so its memory has to be sized
+  // for the full image rather than for the output.
+  memory_manager_.set_limit_bytes(std::max(
+      memory_manager_.limit_bytes(), DecoderMemoryLimit(full_size_bytes)));
+  plane_limit_bytes_ =
+      std::max(plane_limit_bytes_, PlaneMemoryLimit(full_size_bytes));
+}
+
+bool JXLImageDecoder::InitDownscaledFrameBuffer(ImageFrame& frame) {
+  const gfx::Size decoded_size = DecodedSize();
+  // The sums of further threads are added once libjxl reports how many it
+  // uses, see AddDownscaleSumThreads().
+  downscale_sums_.resize(
+      base::checked_cast<wtf_size_t>(decoded_size.Area64() * 4));
+  std::fill(downscale_sums_.begin(), downscale_sums_.end(), 0.0f);
+  if (frame.GetStatus() != ImageFrame::kFrameEmpty) {
+    return true;
+  }
+  if (!frame.AllocatePixelData(decoded_size.width(), decoded_size.height(),
+                               ColorSpaceForSkImages())) {
+    return false;
+  }
+  frame.ZeroFillPixelData();
+  frame.SetStatus(ImageFrame::kFramePartial);
+  frame.SetOriginalFrameRect(gfx::Rect(Size()));
+  return true;
+}
+
+void JXLImageDecoder::ResolveDownscaledPixels(ImageFrame& frame) {
+  if (scale_denominator_ == 1) {
+    return;
+  }
+  const uint32_t width = ScaleDimension(info_.xsize, scale_denominator_);
+  const uint32_t height = ScaleDimension(info_.ysize, scale_denominator_);
+  const skcms_AlphaFormat dst_alpha =
+      (frame.PremultiplyAlpha() && info_.alpha_bits)
+          ? skcms_AlphaFormat_PremulAsEncoded
+          : skcms_AlphaFormat_Unpremul;
+  const auto* src_profile = xform_ ? xform_->SrcProfile() : nullptr;
+  const auto* dst_profile = xform_ ? xform_->DstProfile() : nullptr;
+  const wtf_size_t thread_sums_size = width * height * 4;
+  WTF::Vector<float> row(width * 4);
+  for (uint32_t y = 0; y < height; ++y) {
+    const uint32_t block_height =
+        std::min(scale_denominator_, info_.ysize - y * scale_denominator_);
+    std::fill(row.begin(), row.end(), 0.0f);
+    for (wtf_size_t offset = y * width * 4; offset < downscale_sums_.size();
+         offset += thread_sums_size) {
+      const float* sums = &downscale_sums_[offset];
+      for (uint32_t i = 0; i < width * 4; ++i) {
+        row[i] += sums[i];
+      }
+    }
+    for (uint32_t x = 0; x < width; ++x) {
+      const uint32_t block_width =
+          std::min(scale_denominator_, info_.xsize - x * scale_denominator_);
+      const float scale = 1.0f / (block_width * block_height);
+      for (uint32_t c = 0; c < 4; ++c) {
+        row[x * 4 + c] *= scale;
+      }
+    }
+    void* row_dst =
+        decode_to_half_float_
+            ? reinterpret_cast<void*>(frame.GetAddrF16(0, static_cast<int>(y)))
+            : reinterpret_cast<void*>(frame.GetAddr(0, static_cast<int>(y)));
+    bool color_conversion_successful = skcms_Transform(
+        row.data(), skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul,
+        src_profile, row_dst, FramePixelFormat(), dst_alpha, dst_profile,
+        width);
+    DCHECK(color_conversion_successful);
+  }
+}
+
+void* JXLImageDecoder::AddDownscaleSumThreads(void* opaque,
+                                               size_t num_threads,
+                                               size_t) {
+  JXLImageDecoder* self = reinterpret_cast<JXLImageDecoder*>(opaque);
+  const gfx::Size decoded_size = self->DecodedSize();
+  const size_t thread_sums_size =
+      base::checked_cast<size_t>(decoded_size.Area64() * 4);
+  // libjxl may set up its threads several times per frame, the sums of the
+  // threads it already used are kept.
+  const wtf_size_t size =
+      base::checked_cast<wtf_size_t>(thread_sums_size * num_threads);
+  if (self->downscale_sums_.size() < size) {
+    const wtf_size_t old_size = self->downscale_sums_.size();
+    self->downscale_sums_.resize(size);
+    std::fill(self->downscale_sums_.begin() + old_size,
+              self->downscale_sums_.end(), 0.0f);
+  }
+  return opaque;
+}
+
+void JXLImageDecoder::AddDownscaleSums(void* opaque,
+                                       size_t thread_id,
+                                       size_t x,
+                                       size_t y,
+                                       size_t num_pixels,
+                                       const void* pixels) {
+  JXLImageDecoder* self = reinterpret_cast<JXLImageDecoder*>(opaque);
+  const uint32_t scale = self->scale_denominator_;
+  const size_t width = ScaleDimension(self->info_.xsize, scale);
+  const size_t height = ScaleDimension(self->info_.ysize, scale);
+  const float* src = static_cast<const float*>(pixels);
+  // Each thread adds to sums of its own.
+  float* sums = &self->downscale_sums_[(thread_id * height + y / scale) *
+                                       width * 4];
+  for (size_t i = 0; i < num_pixels; ++i) {
+    float* sum = &sums[((x + i) / scale) * 4];
+    for (size_t c = 0; c < 4; ++c) {
+      sum[c] += src[i * 4 + c];
+    }
+  }
+}
+
+bool JXLImageDecoder::FlushImage(ImageFrame& frame) {
+  // A flush renders every pixel again, including the ones already summed.
+  std::fill(downscale_sums_.begin(), downscale_sums_.end(), 0.0f);
+  if (JXL_DEC_SUCCESS != JxlDecoderFlushImage(dec_.get())) {
+    return false;
+  }
+  ResolveDownscaledPixels(frame);
+  // The pixels rendered from here on replace those of the flush.
+  std::fill(downscale_sums_.begin(), downscale_sums_.end(), 0.0f);
+  frame.SetPixelsChanged(true);
+  return true;
+}
+
+bool JXLImageDecoder::DownscaledFrameCompleteAtDC() const {
+  // The DC image of VarDCT holds the average of every 8x8 block. That of
+  // modular images, lossy ones included, may be empty or squeezed
+  // differently, and alpha is modular in any case.
+  return scale_denominator_ == kDownscaleFactor && single_vardct_frame_ &&
+         info_.alpha_bits == 0;
+}
+
+void JXLImageDecoder::ApplyExifBox(const FastSharedBufferReader& reader) {
+  const std::optional<JXLContainerParser::Box>& exif = container_.exif_box();
+  if (exif_applied_ || !exif || exif->offset > reader.size() ||
+      exif->size > reader.size() - exif->offset) {
+    return;
+  }
+  exif_applied_ = true;
+  // The payload starts with the offset of the TIFF header.
+  constexpr size_t kTiffHeaderOffsetSize = 4;
+  if (exif->size < kTiffHeaderOffsetSize) {
+    return;
+  }
+  char buffer[kTiffHeaderOffsetSize];
+  const uint64_t tiff_offset = ReadBigEndian(
+      reinterpret_cast<const uint8_t*>(reader.GetConsecutiveData(
+          exif->offset, kTiffHeaderOffsetSize, buffer)),
+      kTiffHeaderOffsetSize);
+  if (tiff_offset >= exif->size - kTiffHeaderOffsetSize) {
+    return;
+  }
+  const size_t tiff_size =
+      exif->size - kTiffHeaderOffsetSize - static_cast<size_t>(tiff_offset);
+  sk_sp<SkData> exif_data = CopyData(
+      reader, exif->offset + exif->size - tiff_size, tiff_size);
+  ApplyExifMetadata(exif_data.get(), Size());
+  // The orientation in the image headers takes precedence over the one in
+  // the Exif metadata.
+  orientation_ = static_cast<ImageOrientationEnum>(info_.orientation);
+}
+
+bool JXLImageDecoder::SetSizeFromBasicInfo(
+    const FastSharedBufferReader& reader) {
+  // With the orientation kept, the size is that of the stored pixels, which
+  // the compositor rotates.
+  if (!SetSize(info_.xsize, info_.ysize)) {
+    return false;
+  }
+  orientation_ = static_cast<ImageOrientationEnum>(info_.orientation);
+  ApplyExifBox(reader);
+  UpdateScaleDenominator();
+  parallel_runner_.set_num_threads(NumDecodeThreads());
+  return true;
+}
+
+bool JXLImageDecoder::UpdateProgressiveDetail(size_t data_size) {
+  JxlProgressiveDetail detail = JxlProgressiveDetail::kDC;
+  progressive_flushes_ = !IsAllDataReceived();
+  const base::TimeDelta elapsed = base::TimeTicks::Now() - first_data_time_;
+  // Downscaled frames are complete at the DC, or averaged from the full image.
+  if (progressive_flushes_ && scale_denominator_ == 1 &&
+      IsDecodedSizeAvailable() && elapsed >= kMinRateMeasurementTime &&
+      data_size > 0) {
+    const double bytes_per_second = data_size / elapsed.InSecondsF();
+    const double estimated_size =
+        (info_.uses_original_profile ? kEstimatedLosslessBytesPerPixel
+                                     : kEstimatedLossyBytesPerPixel) *
+        info_.xsize * info_.ysize;
+    // Past the estimate, the image compresses worse than guessed, and nothing
+    // is known about when it will be complete.
+    if (data_size < estimated_size) {
+      const base::TimeDelta load_time =
+          base::Seconds((estimated_size - data_size) / bytes_per_second);
+      if (load_time < kMinLoadTimeForProgression) {
+        progressive_flushes_ = false;
+      } else if (load_time >= kMinLoadTimeForPasses) {
+        detail = JxlProgressiveDetail::kPasses;
+      } else if (load_time >= kMinLoadTimeForLastPasses) {
+        detail = JxlProgressiveDetail::kLastPasses;
+      }
+    }
+  }
+  return JXL_DEC_SUCCESS == JxlDecoderSetProgressiveDetail(dec_.get(), detail);
+}
+
+bool JXLImageDecoder::FlushIsDue(size_t data_size) const {
+  return last_flush_time_.is_null() ||
+         base::TimeTicks::Now() - last_flush_time_ >= kMinFlushInterval ||
+         data_size - data_size_at_last_flush_ >=
+             data_size_at_last_flush_ / kMinFlushDataGrowthDivisor;
+}
+
+ColorProfileTransform* JXLImageDecoder::OutputColorTransform() {
+  return output_to_srgb_ ? nullptr : ColorTransform();
+}
+
+bool JXLImageDecoder::SetOutputColorProfile() {
+  // Only if the frames would otherwise be transformed, to sRGB. Other targets
+  // need a CMS in libjxl, and libjxl tone maps HDR images differently.
+  output_to_srgb_ = !info_.uses_original_profile && !is_hdr_ &&
+                    ColorTransform() && ColorSpaceForSkImages()->isSRGB();
+  if (!output_to_srgb_) {
+    return true;
+  }
+  JxlColorEncoding srgb = {};
+  srgb.color_space = JXL_COLOR_SPACE_RGB;
+  srgb.white_point = JXL_WHITE_POINT_D65;
+  srgb.primaries = JXL_PRIMARIES_SRGB;
+  srgb.transfer_function = JXL_TRANSFER_FUNCTION_SRGB;
+  srgb.rendering_intent = JXL_RENDERING_INTENT_RELATIVE;
+  return JXL_DEC_SUCCESS ==
+         JxlDecoderSetOutputColorProfile(dec_.get(), &srgb, nullptr, 0);
+}
+
+uint32_t JXLImageDecoder::CompactNumChannels() const {
+  if (info_.alpha_bits != 0) {
+    return 4;
+  }
+  // With sRGB output, libjxl renders gray images in color.
+  if (info_.num_color_channels == 1 && !output_to_srgb_ &&
+      output_format_.data_type == JXL_TYPE_UINT8) {
+    return 1;
+  }
+  return 3;
+}
+
+void JXLImageDecoder::SetUpFrameOutput(ImageFrame& frame) {
+  const bool premultiply = frame.PremultiplyAlpha() && info_.alpha_bits != 0;
+  FrameOutput& output = frame_output_;
+  output.frame = &frame;
+  output.half_float = decode_to_half_float_;
+  output.xform = xform_;
+  output.src_format = SkcmsPixelFormat(output_format_);
+  output.dst_format = FramePixelFormat();
+  output.dst_alpha = premultiply ? skcms_AlphaFormat_PremulAsEncoded
+                                 : skcms_AlphaFormat_Unpremul;
+  output.pack_row =
+      xform_ ? nullptr
+             : GetJXLPackRowFunction(output.src_format, output.dst_format,
+                                     premultiply);
+  output.copy = !xform_ && !premultiply &&
+                output.src_format == output.dst_format;
+  output.bytes_per_pixel = BytesPerPixel(output_format_);
+}
+
+// static
+void JXLImageDecoder::WriteFramePixels(void* opaque,
+                                       size_t /*thread_id*/,
+                                       size_t x,
+                                       size_t y,
+                                       size_t num_pixels,
+                                       const void* pixels) {
+  const FrameOutput& output = *static_cast<const FrameOutput*>(opaque);
+  const int dst_x = static_cast<int>(x);
+  const int dst_y = static_cast<int>(y);
+  void* row_dst =
+      output.half_float
+          ? reinterpret_cast<void*>(output.frame->GetAddrF16(dst_x, dst_y))
+          : reinterpret_cast<void*>(output.frame->GetAddr(dst_x, dst_y));
+
+  if (output.pack_row) {
+    output.pack_row(pixels, row_dst, num_pixels);
+  } else if (output.copy) {
+    // Same layout on both sides.
+    memcpy(row_dst, pixels, num_pixels * output.bytes_per_pixel);
+  } else {
+    const auto* src_profile =
+        output.xform ? output.xform->SrcProfile() : nullptr;
+    const auto* dst_profile =
+        output.xform ? output.xform->DstProfile() : nullptr;
+    bool color_conversion_successful = skcms_Transform(
+        pixels, output.src_format, skcms_AlphaFormat_Unpremul, src_profile,
+        row_dst, output.dst_format, output.dst_alpha, dst_profile, num_pixels);
+    DCHECK(color_conversion_successful);
+  }
+}
+
+JxlPixelFormat JXLImageDecoder::OutputPixelFormat() const {
+  // Downscaled frames average floats.
+  if (scale_denominator_ != 1) {
+    return {4, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0};
+  }
+  // Half float frames without a color transform take the samples from libjxl
+  // as they are, the callback at most premultiplies them.
+  if (decode_to_half_float_ && !xform_) {
+    return {4, JXL_TYPE_FLOAT16, JXL_NATIVE_ENDIAN, 0};
+  }
+  // 8-bit SDR images into an N32 frame without a color transform are
+  // requested as 8-bit samples, which the callback only reorders. Everything
+  // else goes through floats, so that transforms keep their precision.
+  const bool is_8bit_sdr = !is_hdr_ && info_.bits_per_sample <= 8 &&
+                           info_.exponent_bits_per_sample == 0;
+  if (!decode_to_half_float_ && !xform_ && is_8bit_sdr) {
+    return {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  }
+  return {4, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0};
+}
+
+skcms_PixelFormat JXLImageDecoder::FramePixelFormat() const {
+  return decode_to_half_float_ ? skcms_PixelFormat_RGBA_hhhh
+                               : XformColorFormat();
+}
+
+bool JXLImageDecoder::CanDecodeDirectlyIntoFrame(
+    const ImageFrame& frame) const {
+  // Only RGBA_F16 frames qualify: libjxl only produces RGBA, and N32 is BGRA
+  // on the platforms this decoder ships on.
+  if (!decode_to_half_float_ || scale_denominator_ != 1 || xform_ ||
+      (frame.PremultiplyAlpha() && frame.HasAlpha())) {
+    return false;
+  }
+  DCHECK_EQ(SkcmsPixelFormat(output_format_), FramePixelFormat());
+  // libjxl writes rows without padding.
+  return frame.Bitmap().rowBytes() ==
+         size_t{info_.xsize} * BytesPerPixel(output_format_);
+}
+
+void JXLImageDecoder::LogDecoderError(JxlDecoderStatus status) const {
+  if (memory_manager_.limit_exceeded()) {
+    DVLOG(1) << "Decoder error " << status << ": memory limit exceeded, "
+             << memory_manager_.allocated_bytes() << " bytes allocated";
+  } else {
+    DVLOG(1) << "Decoder error " << status;
+  }
+}
+
 // Use the provisional Mime type "image/jxl" for JPEG XL images. See
 // https://www.iana.org/assignments/provisional-standard-media-types/provisional-standard-media-types.xhtml.
 const AtomicString& JXLImageDecoder::MimeType() const {
@@ -86,8 +772,18 @@ bool JXLImageDecoder::ReadBytes(size_t remaining,
                                 FastSharedBufferReader* reader,
                                 const uint8_t** jxl_data,
                                 size_t* jxl_size) {
+  // Only the codestream is handed to libjxl, other boxes are skipped.
+  if (!container_.Update(*reader)) {
+    DVLOG(1) << "invalid container";
+    SetFailed();
+    return false;
+  }
+  if (IsDecodedSizeAvailable()) {
+    ApplyExifBox(*reader);
+  }
   *offset -= remaining;
-  if (*offset + remaining >= reader->size()) {
+  if (*offset + remaining >=
+      container_.AvailableCodestreamSize(reader->size())) {
     segment->clear();
     if (IsAllDataReceived()) {
       DVLOG(1) << "need more input but all data received";
@@ -99,7 +795,7 @@ bool JXLImageDecoder::ReadBytes(size_t remaining,
     return false;
   }
   const char* buffer = nullptr;
-  size_t read = reader->GetSomeData(buffer, *offset);
+  size_t read = container_.GetSomeCodestreamData(*reader, *offset, buffer);
 
   if (read > remaining) {
     // Sufficient data present in the segment from the
@@ -109,24 +805,23 @@ bool JXLImageDecoder::ReadBytes(size_t remaining,
     *offset += read;
     segment->clear();
   } else {
-    if (segment->size() == remaining) {
-      // Keep reading from the end of the segment_ we already are
-      // appending to. The above read is ignored, and start reading after the
-      // end of the data we already have.
+    if (segment->size() >= remaining) {
+      // A non-empty segment_ was the previous input, so the remaining bytes
+      // are at its end. Drop the bytes before them and keep appending after
+      // the end of the data we already have. The above read is ignored. The
+      // capacity of segment_ is kept for the next time it is needed.
+      const wtf_size_t consumed =
+          segment->size() - base::checked_cast<wtf_size_t>(remaining);
+      if (consumed) {
+        segment->EraseAt(0, consumed);
+        input_bytes_copied_ += remaining;
+      }
       *offset += remaining;
       read = 0;
     } else {
-      // segment_->size() could be greater than or smaller than remaining.
-      // Typically, it'll be smaller than. If it is greater than, then we could
-      // do something similar as in the segment->size() == remaining case but
-      // remove the non-remaining bytes from the beginning of the segment_
-      // vector. This would avoid re-reading, however the case where
-      // segment->size() > remaining is rare since normally if the JXL decoder
-      // returns a positive value for remaining, it will be consistent, making
-      // the sizes match exactly, so this more complex case is not implemented.
-      // Clear the segment, the bytes from the GetSomeData above will be
-      // appended and then we continue reading from the position after the
-      // above GetSomeData read.
+      // The previous input was handed to the decoder straight from the
+      // reader. The bytes from the GetSomeData above will be appended and
+      // then we continue reading from the position after it.
       segment->clear();
     }
 
@@ -134,6 +829,7 @@ bool JXLImageDecoder::ReadBytes(size_t remaining,
       if (read) {
         *offset += read;
         segment->Append(buffer, base::checked_cast<wtf_size_t>(read));
+        input_bytes_copied_ += read;
       }
       if (segment->size() > remaining) {
         *jxl_data = segment->data();
@@ -142,7 +838,7 @@ bool JXLImageDecoder::ReadBytes(size_t remaining,
         // copy more input than needed into segment_.
         break;
       }
-      read = reader->GetSomeData(buffer, *offset);
+      read = container_.GetSomeCodestreamData(*reader, *offset, buffer);
       if (read == 0) {
         // We tested above that *offset + remaining >= reader.size() so
         // should be able to read all data.
@@ -171,7 +867,8 @@ void JXLImageDecoder::DecodeImpl(wtf_size_t index, bool only_size) {
     // Frame already complete
     return;
   }
-  if ((index < num_decoded_frames_) && dec_ &&
+  bool rewound = false;
+  if (dec_ && (index < num_decoded_frames_) &&
       frame_buffer_cache_[index].GetStatus() != ImageFrame::kFramePartial) {
     // An animation frame that already has been decoded, but does not have
     // status ImageFrame::kFrameComplete, was requested.
@@ -181,31 +878,56 @@ void JXLImageDecoder::DecodeImpl(wtf_size_t index, bool only_size) {
     // (2) During progressive decoding the frame has the status
     // ImageFrame::kFramePartial.
     JxlDecoderRewind(dec_.get());
+    rewound = true;
+    ++num_rewinds_;
     offset_ = 0;
-    // No longer subscribe to JXL_DEC_BASIC_INFO or JXL_DEC_COLOR_ENCODING.
+    segment_.clear();
+    // No longer subscribe to JXL_DEC_BASIC_INFO. JXL_DEC_COLOR_ENCODING is
+    // where the output color profile, which a rewind forgets, is set again.
     if (JXL_DEC_SUCCESS !=
         JxlDecoderSubscribeEvents(
-            dec_.get(), JXL_DEC_FULL_IMAGE | JXL_DEC_FRAME_PROGRESSION)) {
+            dec_.get(), JXL_DEC_COLOR_ENCODING | JXL_DEC_FRAME |
+                            JXL_DEC_FULL_IMAGE | JXL_DEC_FRAME_PROGRESSION)) {
       SetFailed();
       return;
     }
     JxlDecoderSkipFrames(dec_.get(), index);
     num_decoded_frames_ = index;
+    dec_in_frame_ = false;
+    progression_pending_ = false;
+  } else if (dec_ && !dec_in_frame_ && index > num_decoded_frames_) {
+    // Seeking forward from a frame boundary does not need a rewind: libjxl
+    // still decodes the frames the requested one is blended from, but skips
+    // the others, and none of them is output.
+    JxlDecoderSkipFrames(dec_.get(), index - num_decoded_frames_);
+    num_decoded_frames_ = index;
   }
 
   if (!dec_) {
-    dec_ = JxlDecoderMake(nullptr);
+    dec_ = CreateDecoder();
+    if (!dec_) {
+      return;
+    }
     // Subscribe to color encoding event even when only getting size, because
     // SetSize must be called after SetEmbeddedColorProfile
     const int events = JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING |
-                       JXL_DEC_FULL_IMAGE | JXL_DEC_FRAME_PROGRESSION;
+                       JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE |
+                       JXL_DEC_FRAME_PROGRESSION;
 
     if (JXL_DEC_SUCCESS != JxlDecoderSubscribeEvents(dec_.get(), events)) {
       SetFailed();
       return;
     }
     if (JXL_DEC_SUCCESS !=
-        JxlDecoderSetProgressiveDetail(dec_.get(), JxlProgressiveDetail::kDC)) {
+        JxlDecoderSetParallelRunner(dec_.get(), &JXLParallelRunner::Run,
+                                    &parallel_runner_)) {
+      SetFailed();
+      return;
+    }
+    // Orientation is reported to the compositor rather than applied to the
+    // pixels, which saves transposing rotated frames.
+    if (JXL_DEC_SUCCESS !=
+        JxlDecoderSetKeepOrientation(dec_.get(), JXL_TRUE)) {
       SetFailed();
       return;
     }
@@ -215,12 +937,55 @@ void JXLImageDecoder::DecodeImpl(wtf_size_t index, bool only_size) {
 
   FastSharedBufferReader reader(data_.get());
 
-  const JxlPixelFormat format = {4, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0};
-
   const bool size_available = IsDecodedSizeAvailable();
 
+  // The decoder may be used from different threads over its lifetime, so the
+  // thread count is chosen again on every call.
+  parallel_runner_.set_num_threads(size_available ? NumDecodeThreads() : 1);
+
+  // A size-only decode left the output color profile to this call. After a
+  // rewind, it is set on the color encoding event instead.
+  if (output_color_profile_pending_ && !only_size && !rewound) {
+    output_color_profile_pending_ = false;
+    if (!SetOutputColorProfile()) {
+      DVLOG(1) << "JxlDecoderSetOutputColorProfile failed";
+      SetFailed();
+      return;
+    }
+  }
   if (have_color_info_) {
-    xform_ = ColorTransform();
+    xform_ = OutputColorTransform();
+  }
+
+  // The frame cache may have grown, and moved, since the output of the
+  // frame being decoded was set up.
+  if (dec_in_frame_ && num_decoded_frames_ > 0) {
+    frame_output_.frame = &frame_buffer_cache_[num_decoded_frames_ - 1];
+  }
+
+  if (first_data_time_.is_null()) {
+    first_data_time_ = base::TimeTicks::Now();
+  }
+  if (!UpdateProgressiveDetail(reader.size())) {
+    SetFailed();
+    return;
+  }
+
+  // Until the basic info is known, a size-only decode waits for as many
+  // codestream bytes as libjxl suggests, rather than parsing the headers
+  // again for every bit of data that arrives. The hint counts from the start
+  // of the codestream, and is neither an upper nor a lower bound, so this
+  // only skips calls into libjxl that would likely need more input.
+  if (only_size && !size_available && !IsAllDataReceived()) {
+    if (!container_.Update(reader)) {
+      DVLOG(1) << "invalid container";
+      SetFailed();
+      return;
+    }
+    if (container_.AvailableCodestreamSize(reader.size()) <
+        JxlDecoderSizeHintBasicInfo(dec_.get())) {
+      return;
+    }
   }
 
   // The JXL API guarantees that we eventually get JXL_DEC_ERROR,
@@ -233,7 +998,7 @@ void JXLImageDecoder::DecodeImpl(wtf_size_t index, bool only_size) {
     JxlDecoderStatus status = JxlDecoderProcessInput(dec_.get());
     switch (status) {
       case JXL_DEC_ERROR: {
-        DVLOG(1) << "Decoder error " << status;
+        LogDecoderError(status);
         SetFailed();
         return;
       }
@@ -253,14 +1018,26 @@ void JXLImageDecoder::DecodeImpl(wtf_size_t index, bool only_size) {
             // flushed when status was JXL_DEC_FRAME_PROGRESSION because all
             // data seemed to have been received (not knowing then that it was
             // only a partial file).
-            if (JXL_DEC_SUCCESS != JxlDecoderFlushImage(dec_.get())) {
+            ImageFrame& frame = frame_buffer_cache_[num_decoded_frames_ - 1];
+            if (!FlushImage(frame)) {
               DVLOG(1) << "JxlDecoderSetImageOutCallback failed";
               SetFailed();
               return;
             }
+            frame.SetStatus(ImageFrame::kFramePartial);
+          } else if (progression_pending_ && FlushIsDue(reader.size())) {
+            // Renders the progression steps reached in this call at once,
+            // with everything decoded after them.
             ImageFrame& frame = frame_buffer_cache_[num_decoded_frames_ - 1];
-            frame.SetPixelsChanged(true);
+            if (!FlushImage(frame)) {
+              DVLOG(1) << "JxlDecoderSetImageOutCallback failed";
+              SetFailed();
+              return;
+            }
             frame.SetStatus(ImageFrame::kFramePartial);
+            progression_pending_ = false;
+            last_flush_time_ = base::TimeTicks::Now();
+            data_size_at_last_flush_ = reader.size();
           }
           return;
         }
@@ -279,13 +1056,14 @@ void JXLImageDecoder::DecodeImpl(wtf_size_t index, bool only_size) {
           SetFailed();
           return;
         }
-        if (!size_available && !SetSize(info_.xsize, info_.ysize)) {
-          return;
-        }
+        // The size is set on JXL_DEC_COLOR_ENCODING, with the color profile.
         break;
       }
       case JXL_DEC_COLOR_ENCODING: {
         if (IgnoresColorSpace()) {
+          if (!size_available && !SetSizeFromBasicInfo(reader)) {
+            return;
+          }
           have_color_info_ = true;
           continue;
         }
@@ -294,6 +1072,13 @@ void JXLImageDecoder::DecodeImpl(wtf_size_t index, bool only_size) {
         // encoding is already decoded as well, and SetEmbeddedColorProfile
         // should not be called a second time anymore.
         if (size_available) {
+          // Back here after a rewind, which forgot the output color profile.
+          output_color_profile_pending_ = false;
+          if (!SetOutputColorProfile()) {
+            DVLOG(1) << "JxlDecoderSetOutputColorProfile failed";
+            SetFailed();
+            return;
+          }
           continue;
         }
 
@@ -304,10 +1089,12 @@ void JXLImageDecoder::DecodeImpl(wtf_size_t index, bool only_size) {
           is_hdr_ = true;
         }
         JxlColorEncoding color_encoding;
+        std::optional<JxlColorEncoding> original_encoding;
         if (JXL_DEC_SUCCESS == JxlDecoderGetColorAsEncodedProfile(
                                    dec_.get(),
                                    JXL_COLOR_PROFILE_TARGET_ORIGINAL,
                                    &color_encoding)) {
+          original_encoding = color_encoding;
           if (color_encoding.transfer_function == JXL_TRANSFER_FUNCTION_PQ ||
               color_encoding.transfer_function == JXL_TRANSFER_FUNCTION_HLG) {
             is_hdr_ = true;
@@ -380,43 +1167,14 @@ void JXLImageDecoder::DecodeImpl(wtf_size_t index, bool only_size) {
               JXL_DEC_SUCCESS == JxlDecoderGetColorAsICCProfile(
                                      dec_.get(), JXL_COLOR_PROFILE_TARGET_DATA,
                                      icc_profile.data(), icc_profile.size())) {
-            profile =
-                ColorProfile::Create(icc_profile);
-            have_data_profile = true;
-
-            // Detect whether the ICC profile approximately equals PQ or HLG,
-            // and set the profile to one that indicates this transfer function
-            // more clearly than a raw ICC profile does, so Chrome considers
-            // the profile as HDR.
-            skcms_TransferFunction tf_pq;
-            skcms_TransferFunction tf_hlg01;
-            skcms_TransferFunction tf_hlg12;
-            skcms_TransferFunction_makePQ(&tf_pq);
-            MakeTransferFunctionHLG01(&tf_hlg01);
-            skcms_TransferFunction_makeHLG(&tf_hlg12);
-
-            if (ApproximatelyMatchesTF(*profile, tf_pq)) {
+            // Parsing the profile and checking it for HDR transfer functions
+            // is done once per distinct profile.
+            bool icc_is_hdr = false;
+            profile = JXLColorProfileCache::Get().GetProfile(icc_profile,
+                                                             &icc_is_hdr);
+            have_data_profile = !!profile;
+            if (icc_is_hdr) {
               is_hdr_ = true;
-              auto hdr10 = gfx::ColorSpace::CreateHDR10().ToSkColorSpace();
-              skcms_TransferFunction pq;
-              hdr10->transferFn(&pq);
-              profile = NewColorProfileWithSameBuffer(
-                  *profile,
-                  ReplaceTransferFunction(*profile->GetProfile(), pq));
-            } else {
-              for (skcms_TransferFunction tf : {tf_hlg01, tf_hlg12}) {
-                if (ApproximatelyMatchesTF(*profile, tf)) {
-                  is_hdr_ = true;
-                  auto hlg_colorspace =
-                      gfx::ColorSpace::CreateHLG().ToSkColorSpace();
-                  skcms_TransferFunction hlg;
-                  hlg_colorspace->transferFn(&hlg);
-                  profile = NewColorProfileWithSameBuffer(
-                      *profile,
-                      ReplaceTransferFunction(*profile->GetProfile(), hlg));
-                  break;
-                }
-              }
             }
           }
         }
@@ -425,105 +1183,159 @@ void JXLImageDecoder::DecodeImpl(wtf_size_t index, bool only_size) {
             high_bit_depth_decoding_option_ == kHighBitDepthToHalfFloat) {
           decode_to_half_float_ = true;
         }
+        if (is_hdr_) {
+          hdr_metadata_ = MakeHDRMetadata(info_, original_encoding);
+        }
 
         if (have_data_profile) {
           if (profile->GetProfile()->data_color_space == skcms_Signature_RGB) {
             SetEmbeddedColorProfile(std::move(profile));
           }
         }
+        // Blink takes the color space of the frames along with the size, so
+        // the size is only reported once the profile is set.
+        if (!SetSizeFromBasicInfo(reader)) {
+          return;
+        }
+        // Choosing the output color profile needs the color transform, which
+        // a size-only decode leaves to the first pixel decode.
+        if (only_size) {
+          output_color_profile_pending_ = true;
+        } else if (!SetOutputColorProfile()) {
+          DVLOG(1) << "JxlDecoderSetOutputColorProfile failed";
+          SetFailed();
+          return;
+        }
         have_color_info_ = true;
         break;
       }
+      case JXL_DEC_FRAME: {
+        JxlFrameHeader frame_header;
+        if (JxlDecoderGetFrameHeader(dec_.get(), &frame_header) !=
+            JXL_DEC_SUCCESS) {
+          DVLOG(1) << "GetFrameHeader failed";
+          SetFailed();
+          return;
+        }
+        AddFrameToIndex(num_decoded_frames_, frame_header);
+        // libjxl allocates the planes of the frame without the memory
+        // manager, so the limit is checked before it does.
+        const size_t plane_bytes = FramePlaneBytes(info_, frame_header);
+        if (plane_bytes > plane_limit_bytes_) {
+          DVLOG(1) << "Frame needs " << plane_bytes
+                   << " bytes, memory limit is " << plane_limit_bytes_;
+          SetFailed();
+          return;
+        }
+        if (num_decoded_frames_ == 0 && scale_denominator_ != 1) {
+          // libjxl does not report the frame encoding.
+          single_vardct_frame_ =
+              IsSingleVarDCTFrame(CopyCodestreamHeaders(container_, reader));
+        }
+        dec_in_frame_ = true;
+        break;
+      }
       case JXL_DEC_NEED_IMAGE_OUT_BUFFER: {
         const wtf_size_t frame_index = num_decoded_frames_++;
         ImageFrame& frame = frame_buffer_cache_[frame_index];
         // This is guaranteed to occur after JXL_DEC_BASIC_INFO so the size
         // is correct.
-        if (!InitFrameBuffer(frame_index)) {
+        const bool frame_initialized = scale_denominator_ == 1
+                                           ? InitFrameBuffer(frame_index)
+                                           : InitDownscaledFrameBuffer(frame);
+        if (!frame_initialized) {
           DVLOG(1) << "InitFrameBuffer failed";
           SetFailed();
           return;
         }
         frame.SetHasAlpha(info_.alpha_bits != 0);
 
+        // TODO(http://crbug.com/1210465): Add Munsell chart color accuracy
+        // tests for JXL
+        xform_ = OutputColorTransform();
+        output_format_ = OutputPixelFormat();
         size_t buffer_size;
-        if (JXL_DEC_SUCCESS !=
-            JxlDecoderImageOutBufferSize(dec_.get(), &format, &buffer_size)) {
+        if (JXL_DEC_SUCCESS != JxlDecoderImageOutBufferSize(
+                                   dec_.get(), &output_format_, &buffer_size)) {
           DVLOG(1) << "JxlDecoderImageOutBufferSize failed";
           SetFailed();
           return;
         }
-        if (buffer_size != info_.xsize * info_.ysize * 16) {
+        if (buffer_size != size_t{info_.xsize} * info_.ysize *
+                               BytesPerPixel(output_format_)) {
           DVLOG(1) << "Unexpected buffer size";
           SetFailed();
           return;
         }
 
-        // TODO(http://crbug.com/1210465): Add Munsell chart color accuracy
-        // tests for JXL
-        xform_ = ColorTransform();
-        auto callback = [](void* opaque, size_t x, size_t y, size_t num_pixels,
-                           const void* pixels) {
-          JXLImageDecoder* self = reinterpret_cast<JXLImageDecoder*>(opaque);
-          ImageFrame& frame =
-              self->frame_buffer_cache_[self->num_decoded_frames_ - 1];
-          void* row_dst = self->decode_to_half_float_
-                              ? reinterpret_cast<void*>(frame.GetAddrF16(
-                                    static_cast<int>(x), static_cast<int>(y)))
-                              : reinterpret_cast<void*>(frame.GetAddr(
-                                    static_cast<int>(x), static_cast<int>(y)));
-
-          bool dst_premultiply = frame.PremultiplyAlpha();
-
-          const skcms_PixelFormat kSrcFormat = skcms_PixelFormat_RGBA_ffff;
-          const skcms_PixelFormat kDstFormat = self->decode_to_half_float_
-                                                   ? skcms_PixelFormat_RGBA_hhhh
-                                                   : XformColorFormat();
-
-          if (self->xform_ || (kDstFormat != kSrcFormat) ||
-              (dst_premultiply && frame.HasAlpha())) {
-            skcms_AlphaFormat src_alpha = skcms_AlphaFormat_Unpremul;
-            skcms_AlphaFormat dst_alpha =
-                (dst_premultiply && self->info_.alpha_bits)
-                    ? skcms_AlphaFormat_PremulAsEncoded
-                    : skcms_AlphaFormat_Unpremul;
-            const auto* src_profile =
-                self->xform_ ? self->xform_->SrcProfile() : nullptr;
-            const auto* dst_profile =
-                self->xform_ ? self->xform_->DstProfile() : nullptr;
-            bool color_conversion_successful = skcms_Transform(
-                pixels, kSrcFormat, src_alpha, src_profile, row_dst, kDstFormat,
-                dst_alpha, dst_profile, num_pixels);
-            DCHECK(color_conversion_successful);
+        if (CanDecodeDirectlyIntoFrame(frame)) {
+          if (JXL_DEC_SUCCESS !=
+              JxlDecoderSetImageOutBuffer(dec_.get(), &output_format_,
+                                          frame.Bitmap().getPixels(),
+                                          buffer_size)) {
+            DVLOG(1) << "JxlDecoderSetImageOutBuffer failed";
+            SetFailed();
+            return;
           }
-        };
-        if (JXL_DEC_SUCCESS != JxlDecoderSetImageOutCallback(
-                                   dec_.get(), &format, callback, this)) {
-          DVLOG(1) << "JxlDecoderSetImageOutCallback failed";
+          break;
+        }
+
+        if (scale_denominator_ != 1) {
+          if (JXL_DEC_SUCCESS != JxlDecoderSetMultithreadedImageOutCallback(
+                                     dec_.get(), &output_format_,
+                                     &AddDownscaleSumThreads,
+                                     &AddDownscaleSums, nullptr, this)) {
+            DVLOG(1) << "JxlDecoderSetMultithreadedImageOutCallback failed";
+            SetFailed();
+            return;
+          }
+          break;
+        }
+
+        // The callback adds the channels libjxl would only fill with copies
+        // of gray or with opaque alpha.
+        output_format_.num_channels = CompactNumChannels();
+        SetUpFrameOutput(frame);
+        if (JXL_DEC_SUCCESS != JxlDecoderSetMultithreadedImageOutCallback(
+                                   dec_.get(), &output_format_,
+                                   [](void* opaque, size_t, size_t) {
+                                     return opaque;
+                                   },
+                                   &WriteFramePixels, nullptr,
+                                   &frame_output_)) {
+          DVLOG(1) << "JxlDecoderSetMultithreadedImageOutCallback failed";
           SetFailed();
           return;
         }
         break;
       }
       case JXL_DEC_FRAME_PROGRESSION: {
-        if (IsAllDataReceived()) {
-          break;
-        } else {
-          if (JXL_DEC_SUCCESS != JxlDecoderFlushImage(dec_.get())) {
+        if (DownscaledFrameCompleteAtDC()) {
+          // The rest of the file only refines what the 1/8 frame cannot
+          // show. Leave the decoder here: decoding the frame again after it
+          // was purged rewinds it.
+          ImageFrame& frame = frame_buffer_cache_[num_decoded_frames_ - 1];
+          if (!FlushImage(frame)) {
             DVLOG(1) << "JxlDecoderSetImageOutCallback failed";
             SetFailed();
             return;
           }
-          ImageFrame& frame = frame_buffer_cache_[num_decoded_frames_ - 1];
-          frame.SetPixelsChanged(true);
-          frame.SetStatus(ImageFrame::kFramePartial);
-          break;
+          frame.SetStatus(ImageFrame::kFrameComplete);
+          return;
+        }
+        // The frame is flushed once the decoder runs out of data.
+        if (!IsAllDataReceived() && progressive_flushes_) {
+          progression_pending_ = true;
         }
+        break;
       }
       case JXL_DEC_FULL_IMAGE: {
         ImageFrame& frame = frame_buffer_cache_[num_decoded_frames_ - 1];
+        ResolveDownscaledPixels(frame);
         frame.SetPixelsChanged(true);
         frame.SetStatus(ImageFrame::kFrameComplete);
+        dec_in_frame_ = false;
+        progression_pending_ = false;
         // All required frames were decoded.
         if (num_decoded_frames_ > index) {
           return;
@@ -559,7 +1371,8 @@ bool JXLImageDecoder::MatchesJXLSignature(
     return true;
   }
   // Box format container
-  if (!memcmp(contents, "\0\0\0\x0CJXL \x0D\x0A\x87\x0A", 12)) {
+  if (!memcmp(contents, JXLContainerParser::kSignature,
+              JXLContainerParser::kSignatureSize)) {
     return true;
   }
   return false;
@@ -572,6 +1385,42 @@ void JXLImageDecoder::InitializeNewFrame(wtf_size_t index) {
   }
   buffer.SetHasAlpha(info_.alpha_bits != 0);
   buffer.SetPremultiplyAlpha(premultiply_alpha_);
+  if (!info_.have_animation) {
+    return;
+  }
+  if (index < frame_info_.size()) {
+    const FrameInfo& frame_info = frame_info_[index];
+    buffer.SetOriginalFrameRect(frame_info.frame_rect);
+    buffer.SetDuration(frame_info.duration);
+    buffer.SetAlphaBlendSource(frame_info.blend_source);
+  }
+  // Layers persist on the canvas until a later one covers them.
+  buffer.SetDisposalMethod(ImageFrame::kDisposeKeep);
+  buffer.SetRequiredPreviousFrameIndex(
+      FindRequiredPreviousFrame(index, info_.alpha_bits == 0));
+}
+
+wtf_size_t JXLImageDecoder::ClearCacheExceptFrame(
+    wtf_size_t clear_except_frame) {
+  // `dec_` continues from the frame it is in, or else starts the next frame
+  // from its required previous frame, which follows from the blend source of
+  // the frame. Clearing that frame makes the next decode rewind `dec_` to
+  // decode it again.
+  wtf_size_t resume_frame = kNotFound;
+  if (dec_in_frame_) {
+    resume_frame = num_decoded_frames_ - 1;
+  } else if (num_decoded_frames_ < frame_buffer_cache_.size()) {
+    resume_frame =
+        frame_buffer_cache_[num_decoded_frames_].RequiredPreviousFrameIndex();
+  }
+  if (resume_frame == kNotFound || resume_frame == clear_except_frame ||
+      !FrameStatusSufficientForSuccessors(resume_frame)) {
+    return ImageDecoder::ClearCacheExceptFrame(clear_except_frame);
+  }
+  // If `clear_except_frame` is a later frame not decoded yet, the nearest
+  // decoded frame it depends on, which the base class would keep, is
+  // `resume_frame` as well.
+  return ClearCacheExceptTwoFrames(clear_except_frame, resume_frame);
 }
 
 bool JXLImageDecoder::FrameIsReceivedAtIndex(wtf_size_t index) const {
@@ -597,66 +1446,76 @@ int JXLImageDecoder::RepetitionCount() const {
 }
 
 base::TimeDelta JXLImageDecoder::FrameDurationAtIndex(wtf_size_t index) const {
-  if (index < frame_durations_.size()) {
-    return base::Seconds(frame_durations_[index]);
+  if (index < frame_info_.size()) {
+    return frame_info_[index].duration;
   }
 
   return base::TimeDelta();
 }
 
-wtf_size_t JXLImageDecoder::DecodeFrameCount() {
-  DecodeSize();
-  if (!info_.have_animation) {
-    frame_durations_.resize(1);
-    frame_durations_[0] = 0;
-    return 1;
+void JXLImageDecoder::AddFrameToIndex(wtf_size_t index,
+                                      const JxlFrameHeader& frame_header) {
+  if (index != frame_info_.size()) {
+    // Already indexed, or the frames before it are not known yet.
+    return;
   }
-
-  FastSharedBufferReader reader(data_.get());
-  if (has_full_frame_count_ || size_at_last_frame_count_ == reader.size()) {
-    return frame_buffer_cache_.size();
+  FrameInfo frame_info;
+  const JxlLayerInfo& layer_info = frame_header.layer_info;
+  frame_info.frame_rect = gfx::Rect(Size());
+  if (layer_info.have_crop) {
+    // Layers may extend beyond the canvas, only the overlap is drawn.
+    frame_info.frame_rect.Intersect(
+        gfx::Rect(layer_info.crop_x0, layer_info.crop_y0,
+                  base::saturated_cast<int>(layer_info.xsize),
+                  base::saturated_cast<int>(layer_info.ysize)));
   }
-  size_at_last_frame_count_ = reader.size();
-
-  // Decode the metadata of every frame that is available.
-  if (frame_count_dec_ == nullptr) {
-    frame_durations_.clear();
-    frame_count_dec_ = JxlDecoderMake(nullptr);
-    frame_count_offset_ = 0;
-    if (JXL_DEC_SUCCESS !=
-        JxlDecoderSubscribeEvents(frame_count_dec_.get(), JXL_DEC_FRAME)) {
-      SetFailed();
-      return frame_buffer_cache_.size();
-    }
+  // A replacing layer covering the whole canvas does not depend on anything
+  // decoded before it. Any other layer is blended by libjxl onto an earlier
+  // frame. Without alpha, blending replaces as well.
+  const JxlBlendInfo& blend_info = layer_info.blend_info;
+  const bool replaces =
+      blend_info.blendmode == JXL_BLEND_REPLACE ||
+      (blend_info.blendmode == JXL_BLEND_BLEND && info_.alpha_bits == 0);
+  frame_info.blend_source = replaces ? ImageFrame::kBlendAtopBgcolor
+                                     : ImageFrame::kBlendAtopPreviousFrame;
+  if (info_.have_animation) {
+    frame_info.duration = base::Seconds(1.0 * frame_header.duration *
+                                        info_.animation.tps_denominator /
+                                        info_.animation.tps_numerator);
   }
+  frame_info_.push_back(frame_info);
+  if (frame_header.is_last) {
+    has_full_frame_count_ = true;
+  }
+}
 
+bool JXLImageDecoder::IndexFrames() {
+  FastSharedBufferReader reader(data_.get());
   for (;;) {
     JxlDecoderStatus status = JxlDecoderProcessInput(frame_count_dec_.get());
     switch (status) {
       case JXL_DEC_ERROR: {
-        DVLOG(1) << "Decoder error " << status;
+        LogDecoderError(status);
         SetFailed();
-        return frame_buffer_cache_.size();
+        return false;
       }
       case JXL_DEC_NEED_MORE_INPUT: {
         // The decoder returns how many bytes it has not yet processed, and
         // must be included in the next JxlDecoderSetInput call.
-        const size_t remaining = JxlDecoderReleaseInput(frame_count_dec_.get());
+        const size_t remaining =
+            JxlDecoderReleaseInput(frame_count_dec_.get());
         const uint8_t* jxl_data = nullptr;
         size_t jxl_size = 0;
         if (!ReadBytes(remaining, &frame_count_offset_, &frame_count_segment_,
                        &reader, &jxl_data, &jxl_size)) {
-          if (Failed()) {
-            return frame_buffer_cache_.size();
-          }
-          return frame_durations_.size();
+          return !Failed();
         }
 
-        if (JXL_DEC_SUCCESS !=
-            JxlDecoderSetInput(frame_count_dec_.get(), jxl_data, jxl_size)) {
+        if (JXL_DEC_SUCCESS != JxlDecoderSetInput(frame_count_dec_.get(),
+                                                  jxl_data, jxl_size)) {
           DVLOG(1) << "JxlDecoderSetInput failed";
           SetFailed();
-          return frame_buffer_cache_.size();
+          return false;
         }
         break;
       }
@@ -666,31 +1525,68 @@ wtf_size_t JXLImageDecoder::DecodeFrameCount() {
             JXL_DEC_SUCCESS) {
           DVLOG(1) << "GetFrameHeader failed";
           SetFailed();
-          return frame_buffer_cache_.size();
-        }
-        if (frame_header.is_last) {
-          has_full_frame_count_ = true;
+          return false;
         }
-        frame_durations_.push_back(1.0f * frame_header.duration *
-                                   info_.animation.tps_denominator /
-                                   info_.animation.tps_numerator);
+        AddFrameToIndex(frame_count_num_frames_++, frame_header);
         break;
       }
       case JXL_DEC_SUCCESS: {
-        // If the file is fully processed, we won't need to run the decoder
-        // anymore: we can free the memory.
-        frame_count_dec_ = nullptr;
         DCHECK(has_full_frame_count_);
         frame_count_segment_.clear();
-        return frame_durations_.size();
+        return true;
       }
       default: {
         DVLOG(1) << "Unexpected decoder status " << status;
         SetFailed();
-        return frame_buffer_cache_.size();
+        return false;
       }
     }
   }
 }
 
+wtf_size_t JXLImageDecoder::DecodeFrameCount() {
+  DecodeSize();
+  if (!info_.have_animation) {
+    if (frame_info_.empty()) {
+      frame_info_.push_back(FrameInfo());
+    }
+    return 1;
+  }
+
+  FastSharedBufferReader reader(data_.get());
+  if (has_full_frame_count_ || size_at_last_frame_count_ == reader.size()) {
+    // `dec_` may have seen the last frame after the previous call.
+    frame_count_dec_ = nullptr;
+    frame_count_segment_.clear();
+    return Failed() ? frame_buffer_cache_.size() : frame_info_.size();
+  }
+  size_at_last_frame_count_ = reader.size();
+
+  // Decode the metadata of every frame that is available.
+  if (frame_count_dec_ == nullptr) {
+    frame_count_dec_ = CreateDecoder();
+    if (!frame_count_dec_) {
+      return frame_buffer_cache_.size();
+    }
+    frame_count_offset_ = 0;
+    frame_count_num_frames_ = 0;
+    if (JXL_DEC_SUCCESS !=
+        JxlDecoderSubscribeEvents(frame_count_dec_.get(), JXL_DEC_FRAME)) {
+      SetFailed();
+      return frame_buffer_cache_.size();
+    }
+  }
+
+  if (!IndexFrames()) {
+    return frame_buffer_cache_.size();
+  }
+  if (has_full_frame_count_) {
+    // If the file is fully processed, we won't need to run the decoder
+    // anymore: we can free the memory.
+    frame_count_dec_ = nullptr;
+    frame_count_segment_.clear();
+  }
+  return frame_info_.size();
+}
+
 }  // namespace blink
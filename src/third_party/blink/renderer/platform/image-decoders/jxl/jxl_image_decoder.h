@@ -31,9 +31,17 @@
 #ifndef THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_IMAGE_DECODER_H_
 #define THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_IMAGE_DECODER_H_
 
+#include <optional>
+
 #include "base/memory/raw_ptr.h"
 #include "third_party/blink/renderer/platform/image-decoders/fast_shared_buffer_reader.h"
 #include "third_party/blink/renderer/platform/image-decoders/image_decoder.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_container_parser.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_memory_manager.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_parallel_runner.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_pixel_pack.h"
+#include "ui/gfx/geometry/rect.h"
+#include "ui/gfx/hdr_metadata.h"
 
 #include "third_party/libjxl/src/lib/include/jxl/decode.h"
 #include "third_party/libjxl/src/lib/include/jxl/decode_cxx.h"
@@ -46,6 +54,7 @@ class PLATFORM_EXPORT JXLImageDecoder final : public ImageDecoder {
   JXLImageDecoder(AlphaOption,
                   HighBitDepthDecodingOption high_bit_depth_decoding_option,
                   const ColorBehavior&,
+                  cc::AuxImage aux_image,
                   wtf_size_t max_decoded_bytes,
                   AnimationOption);
 
@@ -53,10 +62,34 @@ class PLATFORM_EXPORT JXLImageDecoder final : public ImageDecoder {
   String FilenameExtension() const override { return "jxl"; }
   const AtomicString& MimeType() const override;
   bool ImageIsHighBitDepth() override { return is_hdr_; }
+  std::optional<gfx::HDRMetadata> GetHDRMetadata() const override {
+    return hdr_metadata_;
+  }
+
+  // ImageDecoder:
+  // Also keeps the frame `dec_` continues decoding from, see
+  // `num_decoded_frames_`.
+  wtf_size_t ClearCacheExceptFrame(wtf_size_t clear_except_frame) override;
+  // Still images may be decoded at 1/8 of their size, see
+  // `scale_denominator_`.
+  Vector<SkISize> GetSupportedDecodeSizes() const override;
+  gfx::Size DecodedSize() const override;
+  // Returns the gain map of a `jhgm` box. Its data is a bare JXL codestream,
+  // decoded by another JXLImageDecoder created with cc::AuxImage::kGainmap.
+  bool GetGainmapInfoAndData(
+      SkGainmapInfo& out_gainmap_info,
+      scoped_refptr<SegmentReader>& out_gainmap_data) const override;
 
   // Returns true if the data in fast_reader begins with
   static bool MatchesJXLSignature(const FastSharedBufferReader& fast_reader);
 
+  // The number of bytes copied to make the input of libjxl contiguous, where
+  // it spans several segments of the data.
+  size_t input_bytes_copied() const { return input_bytes_copied_; }
+
+  // The number of times `dec_` was started over to decode frames again.
+  wtf_size_t num_rewinds() const { return num_rewinds_; }
+
  private:
   // ImageDecoder:
   void DecodeSize() override { DecodeImpl(0, true); }
@@ -72,13 +105,22 @@ class PLATFORM_EXPORT JXLImageDecoder final : public ImageDecoder {
   bool FrameIsReceivedAtIndex(wtf_size_t) const override;
   base::TimeDelta FrameDurationAtIndex(wtf_size_t) const override;
   int RepetitionCount() const override;
-  bool CanReusePreviousFrameBuffer(wtf_size_t) const override { return false; }
+
+  // Adds what the header of frame `index` says to `frame_info_`, unless the
+  // frame is already known.
+  void AddFrameToIndex(wtf_size_t index, const JxlFrameHeader& frame_header);
+
+  // Runs `frame_count_dec_` over the available data and adds the frame
+  // headers it sees to `frame_info_`. Returns false if decoding failed.
+  bool IndexFrames();
 
   // Reads bytes from the segment reader, after releasing input from the JXL
   // decoder, which required `remaining` previous bytes to still be available.
   // Starts reading from *offset - remaining, and ensures more than remaining
-  // bytes are read, if possible. Returns false if not enough bytes are
-  // available or if Failed() was set.
+  // bytes are read, if possible. Data is handed out straight from the reader
+  // when a segment holds enough of it, otherwise it is gathered in `segment`,
+  // where bytes still held from the previous call are reused. Returns false if
+  // not enough bytes are available or if Failed() was set.
   bool ReadBytes(size_t remaining,
                  wtf_size_t* offset,
                  WTF::Vector<uint8_t>* segment,
@@ -86,23 +128,202 @@ class PLATFORM_EXPORT JXLImageDecoder final : public ImageDecoder {
                  const uint8_t** jxl_data,
                  size_t* jxl_size);
 
+  // Creates a libjxl decoder allocating through `memory_manager_`. Sets the
+  // "decode failure" flag and returns nullptr on failure.
+  JxlDecoderPtr CreateDecoder();
+
+  // Returns the number of threads libjxl may use for the next decoding step.
+  size_t NumDecodeThreads() const;
+
+  // Whether the image may be decoded at a reduced size. Only valid once the
+  // size is available.
+  bool CanDecodeDownscaled() const;
+
+  // Picks `scale_denominator_` from `max_decoded_bytes_`, the way the JPEG
+  // decoder picks its DCT scale.
+  void UpdateScaleDenominator();
+
+  // Allocates the reduced size frame and the sums its pixels are averaged
+  // from.
+  bool InitDownscaledFrameBuffer(ImageFrame& frame);
+
+  // Writes the averages of the pixels received so far into `frame`. Does
+  // nothing when decoding at full size.
+  void ResolveDownscaledPixels(ImageFrame& frame);
+
+  // The JxlImageOutInitCallback and JxlImageOutRunCallback of downscaled
+  // decodes. `opaque` is the decoder.
+  static void* AddDownscaleSumThreads(void* opaque,
+                                      size_t num_threads,
+                                      size_t num_pixels_per_thread);
+  static void AddDownscaleSums(void* opaque,
+                               size_t thread_id,
+                               size_t x,
+                               size_t y,
+                               size_t num_pixels,
+                               const void* pixels);
+
+  // Has libjxl render everything decoded so far of the current frame into
+  // `frame`. Returns false on failure.
+  bool FlushImage(ImageFrame& frame);
+
+  // Whether the DC progression step of the current still image already holds
+  // the whole downscaled frame.
+  bool DownscaledFrameCompleteAtDC() const;
+
+  // Chooses how often libjxl reports progression, from the rate the data has
+  // arrived at so far and the size of the image: the longer the rest of the
+  // image takes to arrive, the more refinement passes are rendered. Sets
+  // `progressive_flushes_`. Returns false on failure.
+  bool UpdateProgressiveDetail(size_t data_size);
+
+  // Whether enough time passed, or enough data arrived, since the last
+  // intermediate render for another one to be worth it.
+  bool FlushIsDue(size_t data_size) const;
+
+  // Sets the density corrected size from the Exif box, once it has fully
+  // arrived.
+  void ApplyExifBox(const FastSharedBufferReader& reader);
+
+  // Sets the size, orientation and scale from the basic info. Called once the
+  // embedded color profile is set too. Returns false on failure.
+  bool SetSizeFromBasicInfo(const FastSharedBufferReader& reader);
+
+  // Returns the transform the callback applies to the pixels from libjxl, if
+  // any.
+  ColorProfileTransform* OutputColorTransform();
+
+  // Has libjxl output the pixels of XYB images in sRGB, if that is the color
+  // space of the frames. Returns false on failure.
+  bool SetOutputColorProfile();
+
+  // Returns the pixel format to request from libjxl for the next frame.
+  JxlPixelFormat OutputPixelFormat() const;
+
+  // Returns the fewest channels the pixels of the current frame can be
+  // requested in when written by the image out callback: one for 8-bit gray
+  // and three for opaque images.
+  uint32_t CompactNumChannels() const;
+
+  // Fixes how the pixels of `frame` are written by the image out callback,
+  // in `frame_output_`.
+  void SetUpFrameOutput(ImageFrame& frame);
+
+  // The image out callback, which libjxl runs on all the threads of its
+  // parallel runner at once, for disjoint pixels. `opaque` is the
+  // FrameOutput of the frame.
+  static void WriteFramePixels(void* opaque,
+                               size_t thread_id,
+                               size_t x,
+                               size_t y,
+                               size_t num_pixels,
+                               const void* pixels);
+
+  // Returns the skcms format of the pixels of the frames.
+  skcms_PixelFormat FramePixelFormat() const;
+
+  // Returns whether libjxl can write the pixels of `frame` itself, because
+  // the callback would only copy them. Only RGBA_F16 frames qualify.
+  bool CanDecodeDirectlyIntoFrame(const ImageFrame& frame) const;
+
+  // Logs, for a decoder error, whether it was caused by the memory limit.
+  void LogDecoderError(JxlDecoderStatus status) const;
+
+  // Must outlive `dec_` and `frame_count_dec_`, which allocate through it.
+  JXLMemoryManager memory_manager_;
+  // The bytes the planes of a frame may take, which libjxl allocates outside
+  // of `memory_manager_`.
+  size_t plane_limit_bytes_;
+
+  // Must outlive `dec_`, which uses it to distribute work across threads.
+  JXLParallelRunner parallel_runner_;
+
+  // Where the codestream is in the data. `offset_` and `frame_count_offset_`
+  // are positions in the codestream.
+  JXLContainerParser container_;
+
   JxlDecoderPtr dec_ = nullptr;
   wtf_size_t offset_ = 0;
+  // Whether `dec_` has started a frame it did not finish. Otherwise it can
+  // skip forward to a later frame without being rewound.
+  bool dec_in_frame_ = false;
 
   JxlDecoderPtr frame_count_dec_ = nullptr;
   wtf_size_t frame_count_offset_ = 0;
+  wtf_size_t frame_count_num_frames_ = 0;
 
   // The image is considered to be HDR, such as using PQ or HLG transfer
   // function in the color space.
   bool is_hdr_ = false;
+  // Luminance information of HDR images, from the image headers.
+  std::optional<gfx::HDRMetadata> hdr_metadata_;
   bool decode_to_half_float_ = false;
 
   JxlBasicInfo info_;
   bool have_color_info_ = false;
+  // Whether libjxl converts the pixels to sRGB itself. XYB images are
+  // converted from XYB in any case, so targeting sRGB instead of the data
+  // color space is free, and the callback then has nothing to convert.
+  bool output_to_srgb_ = false;
+  // Whether the output color profile is still to be chosen. A size-only
+  // decode leaves it to the first pixel decode, which still finds the decoder
+  // right after the headers, where libjxl accepts it.
+  bool output_color_profile_pending_ = false;
+  // Whether the Exif box was applied.
+  bool exif_applied_ = false;
+
+  // 1 to decode at full size, or 8 to decode still images at the resolution
+  // of their DC image. libjxl always works at full resolution: the reduced
+  // frame averages 8x8 blocks of its output. For single VarDCT frames without
+  // alpha, the DC progression step, which libjxl reaches long before the full
+  // image, already provides those averages and decoding stops there.
+  unsigned scale_denominator_ = 1;
+  // Whether the image is a single VarDCT frame, from the codestream headers
+  // up to the first frame header. Other images wait for the full image.
+  bool single_vardct_frame_ = false;
+  // Sums of the RGBA samples of each 8x8 block, when downscaling. Each decode
+  // thread has sums of its own, one after the other, which are added up when
+  // the frame is resolved.
+  WTF::Vector<float> downscale_sums_;
+
+  // When the first data was decoded, to measure the rate data arrives at.
+  base::TimeTicks first_data_time_;
+  // Whether intermediate renders are flushed at progression events. Not when
+  // the rest of the image is expected to arrive before they would be seen.
+  bool progressive_flushes_ = true;
+  // Whether a progression step was reached since the last intermediate
+  // render of the current frame.
+  bool progression_pending_ = false;
+  base::TimeTicks last_flush_time_;
+  size_t data_size_at_last_flush_ = 0;
+
+  // The format of the pixels handed to the image out callback. Only changes
+  // between frames.
+  JxlPixelFormat output_format_ = {4, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0};
 
   // Preserved for JXL pixel callback. Not owned.
   raw_ptr<ColorProfileTransform> xform_;
 
+  // Everything the image out callback reads, fixed when the output of the
+  // frame is set up and left alone until the frame is done, so that the
+  // threads writing pixels do not touch the rest of the decoder state.
+  struct FrameOutput {
+    raw_ptr<ImageFrame> frame;
+    bool half_float = false;
+    // Converts the pixels when there is no color transform. Null if skcms or
+    // a copy does instead.
+    JXLPackRowFunction pack_row = nullptr;
+    // Not owned.
+    raw_ptr<ColorProfileTransform> xform;
+    skcms_PixelFormat src_format = skcms_PixelFormat_RGBA_ffff;
+    skcms_PixelFormat dst_format = skcms_PixelFormat_RGBA_ffff;
+    skcms_AlphaFormat dst_alpha = skcms_AlphaFormat_Unpremul;
+    // Whether the pixels from libjxl are copied as they are.
+    bool copy = false;
+    size_t bytes_per_pixel = 0;
+  };
+  FrameOutput frame_output_;
+
   // Fields for animation support.
 
   // The amount of frames the JXL decoder has decoded. This can be reset to
@@ -112,12 +333,24 @@ class PLATFORM_EXPORT JXLImageDecoder final : public ImageDecoder {
   wtf_size_t num_decoded_frames_ = 0;
   bool has_full_frame_count_ = false;
   size_t size_at_last_frame_count_ = 0;
-  WTF::Vector<float> frame_durations_;
+
+  // What the header of each frame says, collected by whichever decoder
+  // reaches the frame first. `frame_rect` and `blend_source` describe the
+  // layer the frame draws, so that the frames it depends on are known.
+  // Coalesced frames always replace the whole canvas.
+  struct FrameInfo {
+    base::TimeDelta duration;
+    gfx::Rect frame_rect;
+    ImageFrame::AlphaBlendSource blend_source = ImageFrame::kBlendAtopBgcolor;
+  };
+  WTF::Vector<FrameInfo> frame_info_;
   // Multiple concatenated segments from the FastSharedBufferReader, these are
   // only used when a single segment did not contain enough data for the JXL
   // parser.
   WTF::Vector<uint8_t> segment_;
   WTF::Vector<uint8_t> frame_count_segment_;
+  size_t input_bytes_copied_ = 0;
+  wtf_size_t num_rewinds_ = 0;
 };
 
 }  // namespace blink
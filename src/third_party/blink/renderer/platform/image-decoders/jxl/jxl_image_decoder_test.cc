@@ -4,10 +4,27 @@
 
 #include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_image_decoder.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <memory>
+#include <string>
+#include <utility>
+
 #include "testing/gtest/include/gtest/gtest.h"
 #include "third_party/blink/renderer/platform/image-decoders/image_decoder_test_helpers.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_color_profile_cache.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_container_parser.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_frame_encoding.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_memory_manager.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_parallel_runner.h"
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_pixel_pack.h"
+#include "third_party/blink/renderer/platform/image-decoders/segment_reader.h"
+#include "third_party/blink/renderer/platform/testing/task_environment.h"
 #include "third_party/skia/include/core/SkColorSpace.h"
+#include "third_party/skia/include/core/SkData.h"
+#include "third_party/skia/include/encode/SkICC.h"
+#include "third_party/skia/include/private/SkGainmapInfo.h"
 #include "ui/gfx/geometry/point.h"
 
 namespace blink {
@@ -21,7 +38,8 @@ std::unique_ptr<ImageDecoder> CreateJXLDecoderWithArguments(
     ColorBehavior color_behavior) {
   auto decoder = std::make_unique<JXLImageDecoder>(
       alpha_option, high_bit_depth_decoding_option, color_behavior,
-      ImageDecoder::kNoDecodedImageByteLimit);
+      cc::AuxImage::kDefault, ImageDecoder::kNoDecodedImageByteLimit,
+      ImageDecoder::AnimationOption::kUnspecified);
   scoped_refptr<SharedBuffer> data = ReadFile(jxl_file);
   EXPECT_FALSE(data->empty());
   decoder->SetData(data.get(), true);
@@ -31,7 +49,9 @@ std::unique_ptr<ImageDecoder> CreateJXLDecoderWithArguments(
 std::unique_ptr<ImageDecoder> CreateJXLDecoder() {
   return std::make_unique<JXLImageDecoder>(
       ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
-      ColorBehavior::Tag(), ImageDecoder::kNoDecodedImageByteLimit);
+      ColorBehavior::Tag(), cc::AuxImage::kDefault,
+      ImageDecoder::kNoDecodedImageByteLimit,
+      ImageDecoder::AnimationOption::kUnspecified);
 }
 
 std::unique_ptr<ImageDecoder> CreateJXLDecoderWithData(const char* jxl_file) {
@@ -210,12 +230,33 @@ class PerByteSegmentReader : public SegmentReader {
   SharedBuffer& buffer_;
 };
 
+// SegmentReader implementation for testing, which returns all data as a
+// single segment.
+class ContiguousSegmentReader : public SegmentReader {
+ public:
+  ContiguousSegmentReader(SharedBuffer& buffer) : buffer_(buffer) {}
+  size_t size() const override { return buffer_.size(); }
+  size_t GetSomeData(const char*& data, size_t position) const override {
+    if (position >= buffer_.size()) {
+      return 0;
+    }
+    data = buffer_.Data() + position;
+    return buffer_.size() - position;
+  }
+  sk_sp<SkData> GetAsSkData() const override { return nullptr; }
+
+ private:
+  SharedBuffer& buffer_;
+};
+
 // Tests whether the decoder successfully parses the file without errors or
 // infinite loop in the worst case of the reader returning 1-byte segments.
 void TestSegmented(const char* jxl_file, gfx::Size expected_size) {
   auto decoder = std::make_unique<JXLImageDecoder>(
       ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
-      ColorBehavior::Tag(), ImageDecoder::kNoDecodedImageByteLimit);
+      ColorBehavior::Tag(), cc::AuxImage::kDefault,
+      ImageDecoder::kNoDecodedImageByteLimit,
+      ImageDecoder::AnimationOption::kUnspecified);
   scoped_refptr<SharedBuffer> data = ReadFile(jxl_file);
   EXPECT_FALSE(data->empty());
 
@@ -250,6 +291,37 @@ TEST(JXLTests, SegmentedTest) {
   TestSegmented("/images/resources/jxl/animated.jxl", gfx::Size(16, 16));
 }
 
+// Input is only copied where it spans several segments.
+TEST(JXLTests, InputBytesCopied) {
+  const char* jxl_file = "/images/resources/jxl/3x3_srgb_lossy.jxl";
+  scoped_refptr<SharedBuffer> data = ReadFile(jxl_file);
+  ASSERT_FALSE(data->empty());
+
+  JXLImageDecoder contiguous_decoder(
+      ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
+      ColorBehavior::Tag(), cc::AuxImage::kDefault,
+      ImageDecoder::kNoDecodedImageByteLimit,
+      ImageDecoder::AnimationOption::kUnspecified);
+  contiguous_decoder.SetData(
+      base::AdoptRef(new ContiguousSegmentReader(*data.get())), true);
+  ImageFrame* frame = contiguous_decoder.DecodeFrameBufferAtIndex(0);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  EXPECT_EQ(0u, contiguous_decoder.input_bytes_copied());
+
+  JXLImageDecoder per_byte_decoder(
+      ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
+      ColorBehavior::Tag(), cc::AuxImage::kDefault,
+      ImageDecoder::kNoDecodedImageByteLimit,
+      ImageDecoder::AnimationOption::kUnspecified);
+  per_byte_decoder.SetData(
+      base::AdoptRef(new PerByteSegmentReader(*data.get())), true);
+  frame = per_byte_decoder.DecodeFrameBufferAtIndex(0);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  EXPECT_LT(0u, per_byte_decoder.input_bytes_copied());
+}
+
 TEST(JXLTests, SizeTest) {
   TestSize("/images/resources/jxl/alpha-lossless.jxl", gfx::Size(2, 10));
 }
@@ -618,6 +690,677 @@ TEST(JXLTests, JXLHDRTest) {
           0.45098039507865906, 1);
 }
 
+TEST(JXLTests, HDRMetadata) {
+  auto decoder =
+      CreateJXLDecoderWithData("/images/resources/jxl/pq_gradient_lossless.jxl");
+  ASSERT_TRUE(decoder->IsSizeAvailable());
+  std::optional<gfx::HDRMetadata> hdr_metadata = decoder->GetHDRMetadata();
+  ASSERT_TRUE(hdr_metadata);
+  ASSERT_TRUE(hdr_metadata->cta_861_3);
+  EXPECT_LT(0u, hdr_metadata->cta_861_3->max_content_light_level);
+  ASSERT_TRUE(hdr_metadata->smpte_st_2086);
+  EXPECT_LT(hdr_metadata->smpte_st_2086->luminance_min,
+            hdr_metadata->smpte_st_2086->luminance_max);
+
+  auto sdr_decoder =
+      CreateJXLDecoderWithData("/images/resources/jxl/3x3_srgb_lossy.jxl");
+  ASSERT_TRUE(sdr_decoder->IsSizeAvailable());
+  EXPECT_FALSE(sdr_decoder->GetHDRMetadata());
+}
+
+constexpr uint32_t kParallelRunnerStart = 7;
+constexpr uint32_t kParallelRunnerEnd = 1000;
+
+struct ParallelRunnerTestState {
+  size_t num_threads = 0;
+  std::array<std::atomic<int>, kParallelRunnerEnd> visits = {};
+  std::atomic<bool> thread_ids_in_range = true;
+};
+
+int InitParallelRunnerTest(void* opaque, size_t num_threads) {
+  static_cast<ParallelRunnerTestState*>(opaque)->num_threads = num_threads;
+  return 0;
+}
+
+void RunParallelRunnerTest(void* opaque, uint32_t value, size_t thread_id) {
+  auto* state = static_cast<ParallelRunnerTestState*>(opaque);
+  state->visits[value]++;
+  if (thread_id >= state->num_threads) {
+    state->thread_ids_in_range = false;
+  }
+}
+
+TEST(JXLTests, ParallelRunnerRunsEveryValueOnce) {
+  test::TaskEnvironment task_environment;
+  for (size_t num_threads : {1u, 4u}) {
+    SCOPED_TRACE(testing::Message() << "num_threads: " << num_threads);
+    JXLParallelRunner runner;
+    runner.set_num_threads(num_threads);
+    ParallelRunnerTestState state;
+    EXPECT_EQ(JXL_PARALLEL_RET_SUCCESS,
+              JXLParallelRunner::Run(&runner, &state, &InitParallelRunnerTest,
+                                     &RunParallelRunnerTest,
+                                     kParallelRunnerStart, kParallelRunnerEnd));
+    EXPECT_EQ(num_threads, state.num_threads);
+    EXPECT_TRUE(state.thread_ids_in_range);
+    for (uint32_t i = 0; i < kParallelRunnerEnd; ++i) {
+      EXPECT_EQ(i < kParallelRunnerStart ? 0 : 1, state.visits[i].load());
+    }
+  }
+}
+
+TEST(JXLTests, ParallelRunnerThreadCount) {
+  EXPECT_EQ(1u, JXLParallelRunner::NumThreadsForImageSize(3, 3));
+  EXPECT_EQ(1u, JXLParallelRunner::NumThreadsForImageSize(256, 256));
+  EXPECT_LE(1u, JXLParallelRunner::NumThreadsForImageSize(6000, 4000));
+  EXPECT_GE(8u, JXLParallelRunner::NumThreadsForImageSize(6000, 4000));
+}
+
+// The vectorized conversions match skcms, including for rows whose length is
+// not a multiple of the vector size, and for pixels without alpha.
+TEST(JXLTests, PixelPackMatchesSkcms) {
+  constexpr size_t kNumPixels = 37;
+  std::array<float, kNumPixels * 4> float_pixels;
+  std::array<uint8_t, kNumPixels * 4> u8_pixels;
+  for (size_t i = 0; i < float_pixels.size(); ++i) {
+    float_pixels[i] = ((i * 37) % 271) / 256.0f - 0.02f;
+    u8_pixels[i] = static_cast<uint8_t>(i * 97 + 13);
+  }
+  std::array<uint16_t, kNumPixels * 4> f16_pixels;
+  ASSERT_TRUE(skcms_Transform(
+      float_pixels.data(), skcms_PixelFormat_RGBA_ffff,
+      skcms_AlphaFormat_Unpremul, nullptr, f16_pixels.data(),
+      skcms_PixelFormat_RGBA_hhhh, skcms_AlphaFormat_Unpremul, nullptr,
+      kNumPixels));
+
+  struct Source {
+    const void* pixels;
+    skcms_PixelFormat format;
+  };
+  for (const Source& src :
+       {Source{u8_pixels.data(), skcms_PixelFormat_RGBA_8888},
+        Source{u8_pixels.data(), skcms_PixelFormat_RGB_888},
+        Source{u8_pixels.data(), skcms_PixelFormat_G_8},
+        Source{float_pixels.data(), skcms_PixelFormat_RGBA_ffff},
+        Source{float_pixels.data(), skcms_PixelFormat_RGB_fff},
+        Source{f16_pixels.data(), skcms_PixelFormat_RGBA_hhhh},
+        Source{f16_pixels.data(), skcms_PixelFormat_RGB_hhh}}) {
+    for (skcms_PixelFormat dst_format :
+         {skcms_PixelFormat_RGBA_8888, skcms_PixelFormat_BGRA_8888,
+          skcms_PixelFormat_RGBA_hhhh}) {
+      for (bool premultiply : {false, true}) {
+        SCOPED_TRACE(testing::Message() << src.format << " to " << dst_format
+                                        << " premultiply " << premultiply);
+        JXLPackRowFunction pack_row =
+            GetJXLPackRowFunction(src.format, dst_format, premultiply);
+        if (!pack_row) {
+          continue;
+        }
+        std::array<uint16_t, kNumPixels * 4> expected;
+        std::array<uint16_t, kNumPixels * 4> actual;
+        ASSERT_TRUE(skcms_Transform(
+            src.pixels, src.format, skcms_AlphaFormat_Unpremul, nullptr,
+            expected.data(), dst_format,
+            premultiply ? skcms_AlphaFormat_PremulAsEncoded
+                        : skcms_AlphaFormat_Unpremul,
+            nullptr, kNumPixels));
+        pack_row(src.pixels, actual.data(), kNumPixels);
+        if (dst_format == skcms_PixelFormat_RGBA_hhhh) {
+          // Half floats are compared as floats: skcms flushes denormals.
+          std::array<float, kNumPixels * 4> expected_floats;
+          std::array<float, kNumPixels * 4> actual_floats;
+          for (auto [halfs, floats] :
+               {std::pair(&expected, &expected_floats),
+                std::pair(&actual, &actual_floats)}) {
+            ASSERT_TRUE(skcms_Transform(
+                halfs->data(), skcms_PixelFormat_RGBA_hhhh,
+                skcms_AlphaFormat_Unpremul, nullptr, floats->data(),
+                skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul,
+                nullptr, kNumPixels));
+          }
+          for (size_t i = 0; i < kNumPixels * 4; ++i) {
+            EXPECT_NEAR(expected_floats[i], actual_floats[i], 1e-3f) << i;
+          }
+        } else {
+          const uint8_t* expected_bytes =
+              reinterpret_cast<const uint8_t*>(expected.data());
+          const uint8_t* actual_bytes =
+              reinterpret_cast<const uint8_t*>(actual.data());
+          for (size_t i = 0; i < kNumPixels * 4; ++i) {
+            EXPECT_NEAR(expected_bytes[i], actual_bytes[i], 1) << i;
+          }
+        }
+      }
+    }
+  }
+}
+
+// The codestream is split across two jxlp boxes, around metadata boxes that
+// are skipped.
+TEST(JXLTests, ContainerParser) {
+  const std::string container =
+      std::string(JXLContainerParser::kSignature,
+                  JXLContainerParser::kSignatureSize) +
+      std::string("\0\0\0\x0E" "Exif" "abcdef", 14) +
+      std::string("\0\0\0\x0F" "jxlp" "\0\0\0\0" "\xFF\x0A\x01", 15) +
+      std::string("\0\0\0\x0B" "xml " "xyz", 11) +
+      std::string("\0\0\0\x0E" "jxlp" "\x80\0\0\x01" "\x02\x03", 14);
+  scoped_refptr<SharedBuffer> data =
+      SharedBuffer::Create(container.data(), container.size());
+
+  // Only part of the first codestream box is there.
+  FastSharedBufferReader partial_reader(
+      SegmentReader::CreateFromSharedBuffer(SharedBuffer::Create(
+          container.data(), JXLContainerParser::kSignatureSize + 14 + 13)));
+  JXLContainerParser partial_parser;
+  ASSERT_TRUE(partial_parser.Update(partial_reader));
+  EXPECT_EQ(1u, partial_parser.AvailableCodestreamSize(partial_reader.size()));
+  EXPECT_TRUE(partial_parser.exif_box());
+  EXPECT_FALSE(partial_parser.gainmap_box());
+
+  // Boxes end beyond the data while it arrives byte by byte.
+  JXLContainerParser streaming_parser;
+  for (size_t size = 0; size <= container.size(); ++size) {
+    FastSharedBufferReader streaming_reader(
+        SegmentReader::CreateFromSharedBuffer(
+            SharedBuffer::Create(container.data(), size)));
+    ASSERT_TRUE(streaming_parser.Update(streaming_reader));
+  }
+  EXPECT_EQ(5u, streaming_parser.AvailableCodestreamSize(container.size()));
+
+  FastSharedBufferReader reader(SegmentReader::CreateFromSharedBuffer(data));
+  JXLContainerParser parser;
+  ASSERT_TRUE(parser.Update(reader));
+  ASSERT_EQ(5u, parser.AvailableCodestreamSize(reader.size()));
+  std::string codestream;
+  while (codestream.size() < 5) {
+    const char* bytes = nullptr;
+    const size_t size =
+        parser.GetSomeCodestreamData(reader, codestream.size(), bytes);
+    ASSERT_LT(0u, size);
+    codestream.append(bytes, size);
+  }
+  EXPECT_EQ(std::string("\xFF\x0A\x01\x02\x03", 5), codestream);
+  const char* bytes = nullptr;
+  EXPECT_EQ(0u, parser.GetSomeCodestreamData(reader, 5, bytes));
+
+  ASSERT_TRUE(parser.exif_box());
+  EXPECT_EQ(JXLContainerParser::kSignatureSize + 8, parser.exif_box()->offset);
+  EXPECT_EQ(6u, parser.exif_box()->size);
+}
+
+// The orientation in the image headers wins over the one in the Exif box.
+TEST(JXLTests, OrientationFromHeaders) {
+  scoped_refptr<SharedBuffer> codestream =
+      ReadFile("/images/resources/jxl/3x3_srgb_lossless.jxl");
+  const Vector<char> codestream_data = codestream->CopyAs<Vector<char>>();
+  const std::string container =
+      std::string(JXLContainerParser::kSignature,
+                  JXLContainerParser::kSignatureSize) +
+      std::string("\0\0\0\x26" "Exif" "\0\0\0\0"
+                  "MM\0\x2A" "\0\0\0\x08" "\0\x01"
+                  "\x01\x12" "\0\x03" "\0\0\0\x01" "\0\x06\0\0" "\0\0\0\0",
+                  38) +
+      std::string("\0\0\0\0" "jxlc", 8) +
+      std::string(codestream_data.data(), codestream_data.size());
+
+  scoped_refptr<SharedBuffer> data =
+      SharedBuffer::Create(container.data(), container.size());
+
+  auto decoder = CreateJXLDecoder();
+  decoder->SetData(data.get(), true);
+  ASSERT_TRUE(decoder->IsSizeAvailable());
+  EXPECT_EQ(gfx::Size(3, 3), decoder->Size());
+  EXPECT_EQ(ImageOrientationEnum::kOriginTopLeft,
+            decoder->Orientation().Orientation());
+  ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(0);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  EXPECT_EQ(ImageOrientationEnum::kOriginTopLeft,
+            decoder->Orientation().Orientation());
+}
+
+TEST(JXLTests, ColorProfileCache) {
+  sk_sp<SkData> icc =
+      SkWriteICCProfile(SkNamedTransferFn::kSRGB, SkNamedGamut::kDisplayP3);
+  ASSERT_TRUE(icc);
+  const base::span<const uint8_t> icc_span(icc->bytes(), icc->size());
+
+  bool is_hdr = true;
+  std::unique_ptr<ColorProfile> first =
+      JXLColorProfileCache::Get().GetProfile(icc_span, &is_hdr);
+  ASSERT_TRUE(first);
+  EXPECT_FALSE(is_hdr);
+
+  // The second lookup shares the profile parsed by the first.
+  is_hdr = true;
+  std::unique_ptr<ColorProfile> second =
+      JXLColorProfileCache::Get().GetProfile(icc_span, &is_hdr);
+  ASSERT_TRUE(second);
+  EXPECT_FALSE(is_hdr);
+  EXPECT_EQ(first->GetProfile()->buffer, second->GetProfile()->buffer);
+  EXPECT_NE(static_cast<const void*>(icc->bytes()),
+            second->GetProfile()->buffer);
+
+  const uint8_t garbage[] = {1, 2, 3, 4};
+  EXPECT_FALSE(JXLColorProfileCache::Get().GetProfile(garbage, &is_hdr));
+}
+
+// Large profiles are not cached, each lookup has a buffer of its own.
+TEST(JXLTests, ColorProfileCacheSkipsLargeProfiles) {
+  sk_sp<SkData> icc =
+      SkWriteICCProfile(SkNamedTransferFn::kSRGB, SkNamedGamut::kRec2020);
+  ASSERT_TRUE(icc);
+  // Padding that no tag refers to, with the size in the header to match.
+  Vector<uint8_t> large_icc;
+  large_icc.Append(icc->bytes(), static_cast<wtf_size_t>(icc->size()));
+  large_icc.resize(JXLColorProfileCache::kMaxCachedProfileSize + 1);
+  const uint32_t size = large_icc.size();
+  for (int i = 0; i < 4; ++i) {
+    large_icc[i] = static_cast<uint8_t>(size >> (8 * (3 - i)));
+  }
+
+  bool is_hdr = true;
+  std::unique_ptr<ColorProfile> first =
+      JXLColorProfileCache::Get().GetProfile(large_icc, &is_hdr);
+  ASSERT_TRUE(first);
+  EXPECT_FALSE(is_hdr);
+  std::unique_ptr<ColorProfile> second =
+      JXLColorProfileCache::Get().GetProfile(large_icc, &is_hdr);
+  ASSERT_TRUE(second);
+  EXPECT_NE(first->GetProfile()->buffer, second->GetProfile()->buffer);
+}
+
+TEST(JXLTests, MemoryManagerAccounting) {
+  JXLMemoryManager memory_manager(1000);
+  const JxlMemoryManager* jxl_memory_manager = memory_manager.get();
+  void* a = jxl_memory_manager->alloc(jxl_memory_manager->opaque, 600);
+  ASSERT_TRUE(a);
+  EXPECT_EQ(600u, memory_manager.allocated_bytes());
+  EXPECT_FALSE(jxl_memory_manager->alloc(jxl_memory_manager->opaque, 600));
+  EXPECT_TRUE(memory_manager.limit_exceeded());
+  void* b = jxl_memory_manager->alloc(jxl_memory_manager->opaque, 400);
+  ASSERT_TRUE(b);
+  EXPECT_EQ(1000u, memory_manager.allocated_bytes());
+  jxl_memory_manager->free(jxl_memory_manager->opaque, a);
+  jxl_memory_manager->free(jxl_memory_manager->opaque, b);
+  EXPECT_EQ(0u, memory_manager.allocated_bytes());
+}
+
+TEST(JXLTests, MemoryLimitAllowsSmallImages) {
+  // A byte limit of exactly the 3x3 output image is far less than libjxl
+  // needs for its tables, which the memory limit has to leave room for.
+  auto decoder = std::make_unique<JXLImageDecoder>(
+      ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
+      ColorBehavior::Tag(), cc::AuxImage::kDefault, 3 * 3 * 4,
+      ImageDecoder::AnimationOption::kUnspecified);
+  scoped_refptr<SharedBuffer> data =
+      ReadFile("/images/resources/jxl/3x3_srgb_lossy.jxl");
+  ASSERT_FALSE(data->empty());
+  decoder->SetData(data.get(), true);
+  ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(0);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  EXPECT_FALSE(decoder->Failed());
+}
+
+// Animations are not downscaled, so one whose frames are far larger than the
+// byte limit fails before libjxl allocates their planes.
+TEST(JXLTests, MemoryLimitFailsOversizedAnimation) {
+  const char* jxl_file = "/images/resources/jxl/count.jxl";
+  for (bool oversized : {false, true}) {
+    // count.jxl is a 500x500 animation without alpha.
+    const wtf_size_t max_decoded_bytes =
+        oversized ? 100 * 100 * 4 : 500 * 500 * 4;
+    auto decoder = std::make_unique<JXLImageDecoder>(
+        ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
+        ColorBehavior::Tag(), cc::AuxImage::kDefault, max_decoded_bytes,
+        ImageDecoder::AnimationOption::kUnspecified);
+    scoped_refptr<SharedBuffer> data = ReadFile(jxl_file);
+    ASSERT_FALSE(data->empty());
+    decoder->SetData(data.get(), true);
+    ASSERT_TRUE(decoder->IsSizeAvailable());
+    EXPECT_LT(1u, decoder->FrameCount());
+    ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(0);
+    EXPECT_EQ(oversized, decoder->Failed());
+    if (!oversized) {
+      ASSERT_TRUE(frame);
+      EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+    }
+  }
+}
+
+TEST(JXLTests, SmallImagesAreNotDownscaled) {
+  // Asking for less than the 3x3 output still decodes at full size, there is
+  // nothing to gain from the DC image of such a small image.
+  auto decoder = std::make_unique<JXLImageDecoder>(
+      ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
+      ColorBehavior::Tag(), cc::AuxImage::kDefault, 4,
+      ImageDecoder::AnimationOption::kUnspecified);
+  scoped_refptr<SharedBuffer> data =
+      ReadFile("/images/resources/jxl/3x3_srgb_lossy.jxl");
+  ASSERT_FALSE(data->empty());
+  decoder->SetData(data.get(), true);
+  ASSERT_TRUE(decoder->IsSizeAvailable());
+  EXPECT_TRUE(decoder->GetSupportedDecodeSizes().empty());
+  EXPECT_EQ(decoder->Size(), decoder->DecodedSize());
+  ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(0);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(3, frame->Bitmap().width());
+  EXPECT_EQ(3, frame->Bitmap().height());
+}
+
+// Expects each pixel of `bitmap` to be the average of an 8x8 block of
+// `full_bitmap`, give or take `tolerance`.
+void ExpectBoxFiltered(const SkBitmap& full_bitmap,
+                       const SkBitmap& bitmap,
+                       int tolerance) {
+  ASSERT_EQ((full_bitmap.width() + 7) / 8, bitmap.width());
+  ASSERT_EQ((full_bitmap.height() + 7) / 8, bitmap.height());
+  for (int y = 0; y < bitmap.height(); ++y) {
+    for (int x = 0; x < bitmap.width(); ++x) {
+      int sums[4] = {};
+      for (int block_y = 0; block_y < 8; ++block_y) {
+        for (int block_x = 0; block_x < 8; ++block_x) {
+          const SkColor color =
+              full_bitmap.getColor(x * 8 + block_x, y * 8 + block_y);
+          for (int c = 0; c < 4; ++c) {
+            sums[c] += (color >> (8 * c)) & 255;
+          }
+        }
+      }
+      const SkColor color = bitmap.getColor(x, y);
+      for (int c = 0; c < 4; ++c) {
+        EXPECT_NEAR((sums[c] + 32) / 64, (color >> (8 * c)) & 255, tolerance)
+            << "at " << x << "," << y;
+      }
+    }
+  }
+}
+
+// Lossless images are modular and only complete at the full image, whose 8x8
+// blocks the downscaled frame averages.
+TEST(JXLTests, DownscaledFrameIsBoxFiltered) {
+  const char* jxl_file = "/images/resources/jxl/large_gradient_lossless.jxl";
+  auto full_decoder = CreateJXLDecoderWithData(jxl_file);
+  ImageFrame* full_frame = full_decoder->DecodeFrameBufferAtIndex(0);
+  ASSERT_TRUE(full_frame);
+  ASSERT_EQ(ImageFrame::kFrameComplete, full_frame->GetStatus());
+  ASSERT_EQ(256, full_frame->Bitmap().width());
+  ASSERT_EQ(256, full_frame->Bitmap().height());
+
+  auto decoder = std::make_unique<JXLImageDecoder>(
+      ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
+      ColorBehavior::Tag(), cc::AuxImage::kDefault, 256 * 256,
+      ImageDecoder::AnimationOption::kUnspecified);
+  scoped_refptr<SharedBuffer> data = ReadFile(jxl_file);
+  ASSERT_FALSE(data->empty());
+  decoder->SetData(data.get(), true);
+  ASSERT_TRUE(decoder->IsSizeAvailable());
+  EXPECT_EQ(gfx::Size(32, 32), decoder->DecodedSize());
+  ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(0);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  EXPECT_FALSE(decoder->Failed());
+  ExpectBoxFiltered(full_frame->Bitmap(), frame->Bitmap(), 2);
+}
+
+// The DC image of a single VarDCT frame already holds the averages of its 8x8
+// blocks, the downscaled frame is complete without the AC.
+TEST(JXLTests, DownscaledFrameIsCompleteAtDC) {
+  const char* jxl_file = "/images/resources/jxl/large_gradient_lossy.jxl";
+  auto full_decoder = CreateJXLDecoderWithData(jxl_file);
+  ImageFrame* full_frame = full_decoder->DecodeFrameBufferAtIndex(0);
+  ASSERT_TRUE(full_frame);
+  ASSERT_EQ(ImageFrame::kFrameComplete, full_frame->GetStatus());
+  ASSERT_EQ(512, full_frame->Bitmap().width());
+  ASSERT_EQ(256, full_frame->Bitmap().height());
+
+  auto decoder = std::make_unique<JXLImageDecoder>(
+      ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
+      ColorBehavior::Tag(), cc::AuxImage::kDefault, 512 * 256,
+      ImageDecoder::AnimationOption::kUnspecified);
+  scoped_refptr<SharedBuffer> data = ReadFile(jxl_file);
+  ASSERT_FALSE(data->empty());
+  // Leave out the AC sections, in the last 5 bytes of the file: only the DC
+  // progression step can complete the frame.
+  decoder->SetData(SharedBuffer::Create(data->Data(), data->size() - 5).get(),
+                   true);
+  ASSERT_TRUE(decoder->IsSizeAvailable());
+  EXPECT_EQ(gfx::Size(64, 32), decoder->DecodedSize());
+  ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(0);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  EXPECT_FALSE(decoder->Failed());
+  // libjxl upsamples the DC image smoothly, while the full image has flat
+  // blocks, smoothed at their edges only.
+  ExpectBoxFiltered(full_frame->Bitmap(), frame->Bitmap(), 4);
+}
+
+TEST(JXLTests, SingleVarDCTFrame) {
+  const auto is_single_vardct_frame = [](const char* jxl_file) {
+    scoped_refptr<SharedBuffer> data = ReadFile(jxl_file);
+    EXPECT_FALSE(data->empty());
+    const Vector<uint8_t> codestream = data->CopyAs<Vector<uint8_t>>();
+    return IsSingleVarDCTFrame(codestream);
+  };
+  EXPECT_TRUE(
+      is_single_vardct_frame("/images/resources/jxl/3x3_srgb_lossy.jxl"));
+  EXPECT_TRUE(is_single_vardct_frame("/images/resources/jxl/3x3_pq_lossy.jxl"));
+  EXPECT_TRUE(
+      is_single_vardct_frame("/images/resources/jxl/large_gradient_lossy.jxl"));
+  EXPECT_FALSE(
+      is_single_vardct_frame("/images/resources/jxl/3x3_srgb_lossless.jxl"));
+  EXPECT_FALSE(is_single_vardct_frame(
+      "/images/resources/jxl/large_gradient_lossless.jxl"));
+  // Alpha is an extra channel.
+  EXPECT_FALSE(
+      is_single_vardct_frame("/images/resources/jxl/3x3a_srgb_lossy.jxl"));
+  EXPECT_FALSE(is_single_vardct_frame("/images/resources/jxl/animated.jxl"));
+  // The headers are cut short.
+  EXPECT_FALSE(
+      is_single_vardct_frame("/images/resources/jxl/partial_black.jxl"));
+
+  const uint8_t not_jxl[] = {1, 2, 3, 4};
+  EXPECT_FALSE(IsSingleVarDCTFrame(not_jxl));
+}
+
+TEST(JXLTests, NoGainmapWithoutBox) {
+  // A bare codestream, and a container without a jhgm box.
+  for (const char* jxl_file : {"/images/resources/jxl/red-10-default.jxl",
+                               "/images/resources/jxl/red-10-container.jxl"}) {
+    SCOPED_TRACE(jxl_file);
+    auto decoder = CreateJXLDecoderWithData(jxl_file);
+    SkGainmapInfo gainmap_info;
+    scoped_refptr<SegmentReader> gainmap_data;
+    EXPECT_FALSE(decoder->GetGainmapInfoAndData(gainmap_info, gainmap_data));
+    EXPECT_FALSE(gainmap_data);
+  }
+}
+
+// Frames that arrive after decoding started are counted, with their durations.
+TEST(JXLTests, FrameCountWhileStreaming) {
+  const char* jxl_file = "/images/resources/jxl/count.jxl";
+  auto reference_decoder = CreateJXLDecoderWithData(jxl_file);
+  const wtf_size_t num_frames = reference_decoder->FrameCount();
+  ASSERT_LT(1u, num_frames);
+
+  scoped_refptr<SharedBuffer> data = ReadFile(jxl_file);
+  auto decoder = CreateJXLDecoder();
+  scoped_refptr<SharedBuffer> partial_data =
+      SharedBuffer::Create(data->Data(), data->size() / 2);
+  decoder->SetData(partial_data.get(), false);
+  const wtf_size_t partial_frame_count = decoder->FrameCount();
+  EXPECT_GE(num_frames, partial_frame_count);
+  if (partial_frame_count > 0) {
+    decoder->DecodeFrameBufferAtIndex(0);
+  }
+  EXPECT_FALSE(decoder->Failed());
+
+  decoder->SetData(data.get(), true);
+  ASSERT_EQ(num_frames, decoder->FrameCount());
+  for (wtf_size_t i = 0; i < num_frames; ++i) {
+    EXPECT_EQ(reference_decoder->FrameDurationAtIndex(i),
+              decoder->FrameDurationAtIndex(i));
+    ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(i);
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  }
+  EXPECT_FALSE(decoder->Failed());
+}
+
+// The size is known once the headers arrived, long before the pixels, along
+// with the color profile. The output color profile left to the first pixel
+// decode still applies.
+TEST(JXLTests, SizeAvailableFromHeaders) {
+  const char* jxl_file = "/images/resources/jxl/icc-v2-gbr.jxl";
+  scoped_refptr<SharedBuffer> data = ReadFile(jxl_file);
+  ASSERT_FALSE(data->empty());
+  auto decoder = std::make_unique<JXLImageDecoder>(
+      ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
+      ColorBehavior::TransformToSRGB(), cc::AuxImage::kDefault,
+      ImageDecoder::kNoDecodedImageByteLimit,
+      ImageDecoder::AnimationOption::kUnspecified);
+  size_t prefix_size = 0;
+  do {
+    prefix_size = std::min(prefix_size + 16, data->size());
+    decoder->SetData(SharedBuffer::Create(data->Data(), prefix_size).get(),
+                     false);
+  } while (!decoder->IsSizeAvailable() && !decoder->Failed() &&
+           prefix_size < data->size());
+  EXPECT_FALSE(decoder->Failed());
+  EXPECT_TRUE(decoder->IsSizeAvailable());
+  EXPECT_LT(prefix_size, data->size() / 2);
+  // The size comes with the ICC profile, even if the data ended in between.
+  EXPECT_TRUE(decoder->HasEmbeddedColorProfile());
+
+  decoder->SetData(data.get(), true);
+  ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(0);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  const SkColor expected_color = SkColorSetARGB(255, 0x6b, 0xb1, 0xfe);
+  const SkColor frame_color = frame->Bitmap().getColor(0, 0);
+  for (int i = 0; i < 4; ++i) {
+    int frame_comp = (frame_color >> (8 * i)) & 255;
+    int expected_comp = (expected_color >> (8 * i)) & 255;
+    EXPECT_GE(1, abs(frame_comp - expected_comp));
+  }
+}
+
+// Seeking forward skips the intermediate frames instead of outputting them.
+TEST(JXLTests, SeekForwardSkipsFrames) {
+  const char* jxl_file = "/images/resources/jxl/count.jxl";
+  auto reference_decoder = CreateJXLDecoderWithData(jxl_file);
+  const wtf_size_t num_frames = reference_decoder->FrameCount();
+  ASSERT_LT(2u, num_frames);
+  const wtf_size_t last_frame = num_frames - 1;
+
+  auto decoder = CreateJXLDecoderWithData(jxl_file);
+  ASSERT_EQ(num_frames, decoder->FrameCount());
+  ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(last_frame);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  for (wtf_size_t i = 0; i < last_frame; ++i) {
+    EXPECT_FALSE(decoder->FrameIsDecodedAtIndex(i));
+  }
+
+  for (wtf_size_t i = 0; i < num_frames; ++i) {
+    SCOPED_TRACE(testing::Message() << "Frame: " << i);
+    ImageFrame* reference_frame =
+        reference_decoder->DecodeFrameBufferAtIndex(i);
+    frame = decoder->DecodeFrameBufferAtIndex(i);
+    ASSERT_TRUE(reference_frame);
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(HashBitmap(reference_frame->Bitmap()),
+              HashBitmap(frame->Bitmap()));
+  }
+  EXPECT_FALSE(decoder->Failed());
+}
+
+// Zero duration frames are layers shown coalesced with the frame after them.
+// Seeking the coalesced frames must not go by the indices of the layers.
+TEST(JXLTests, SeekWithHiddenLayers) {
+  // Frames 1, 3, 4 and 7 of count.jxl, which replace the whole canvas, have
+  // zero duration in count-hidden-layers.jxl.
+  constexpr std::array<wtf_size_t, 6> kShownFrames = {0, 2, 5, 6, 8, 9};
+  auto reference_decoder =
+      CreateJXLDecoderWithData("/images/resources/jxl/count.jxl");
+  auto decoder =
+      CreateJXLDecoderWithData("/images/resources/jxl/count-hidden-layers.jxl");
+  ASSERT_EQ(kShownFrames.size(), decoder->FrameCount());
+
+  for (wtf_size_t i : {5u, 1u, 4u, 0u, 3u, 2u}) {
+    SCOPED_TRACE(testing::Message() << "Frame: " << i);
+    ImageFrame* reference_frame =
+        reference_decoder->DecodeFrameBufferAtIndex(kShownFrames[i]);
+    ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(i);
+    ASSERT_TRUE(reference_frame);
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+    EXPECT_EQ(HashBitmap(reference_frame->Bitmap()),
+              HashBitmap(frame->Bitmap()));
+    // Drop the frame, so that it is decoded again after a rewind.
+    decoder->ClearCacheExceptFrame(kNotFound);
+  }
+  EXPECT_FALSE(decoder->Failed());
+}
+
+// Clearing the cache while the decoder is in the middle of a frame keeps that
+// frame, so that the decode goes on once more data arrives instead of
+// starting over.
+TEST(JXLTests, ClearCacheKeepsFrameInProgress) {
+  const char* jxl_file = "/images/resources/jxl/count.jxl";
+  auto reference_decoder = CreateJXLDecoderWithData(jxl_file);
+  scoped_refptr<SharedBuffer> data = ReadFile(jxl_file);
+  ASSERT_FALSE(data->empty());
+  // Frame 6 of count.jxl takes up bytes 7239 to 8573.
+  scoped_refptr<SharedBuffer> partial_data =
+      SharedBuffer::Create(data->Data(), 7900);
+
+  JXLImageDecoder decoder(
+      ImageDecoder::kAlphaNotPremultiplied, ImageDecoder::kDefaultBitDepth,
+      ColorBehavior::Tag(), cc::AuxImage::kDefault,
+      ImageDecoder::kNoDecodedImageByteLimit,
+      ImageDecoder::AnimationOption::kUnspecified);
+  decoder.SetData(partial_data.get(), false);
+  ASSERT_EQ(7u, decoder.FrameCount());
+  for (wtf_size_t i = 0; i < 6; ++i) {
+    ImageFrame* frame = decoder.DecodeFrameBufferAtIndex(i);
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  }
+  ImageFrame* frame = decoder.DecodeFrameBufferAtIndex(6);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(ImageFrame::kFramePartial, frame->GetStatus());
+
+  const wtf_size_t num_rewinds = decoder.num_rewinds();
+  decoder.ClearCacheExceptFrame(5);
+  decoder.SetData(data.get(), true);
+  frame = decoder.DecodeFrameBufferAtIndex(6);
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(ImageFrame::kFrameComplete, frame->GetStatus());
+  EXPECT_EQ(num_rewinds, decoder.num_rewinds());
+  ImageFrame* reference_frame = reference_decoder->DecodeFrameBufferAtIndex(6);
+  ASSERT_TRUE(reference_frame);
+  EXPECT_EQ(HashBitmap(reference_frame->Bitmap()), HashBitmap(frame->Bitmap()));
+  EXPECT_FALSE(decoder.Failed());
+}
+
+// Coalesced frames cover the whole canvas, so none of them depends on the
+// frames before it.
+TEST(JXLTests, CoalescedFramesAreIndependent) {
+  auto decoder = CreateJXLDecoderWithData("/images/resources/jxl/count.jxl");
+  const wtf_size_t num_frames = decoder->FrameCount();
+  ASSERT_LT(1u, num_frames);
+  for (wtf_size_t i = 0; i < num_frames; ++i) {
+    ImageFrame* frame = decoder->DecodeFrameBufferAtIndex(i);
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(gfx::Rect(decoder->Size()), frame->OriginalFrameRect());
+    EXPECT_EQ(ImageFrame::kBlendAtopBgcolor, frame->GetAlphaBlendSource());
+    EXPECT_EQ(kNotFound, frame->RequiredPreviousFrameIndex());
+  }
+}
+
 TEST(JXLTests, RandomFrameDecode) {
   TestRandomFrameDecode(&CreateJXLDecoder, "/images/resources/jxl/count.jxl");
 }
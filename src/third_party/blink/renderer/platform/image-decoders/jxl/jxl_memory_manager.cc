@@ -0,0 +1,90 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_memory_manager.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <cstddef>
+
+#include "base/check_op.h"
+#include "base/numerics/checked_math.h"
+#include "third_party/blink/renderer/platform/wtf/allocator/partitions.h"
+
+#ifdef UNSAFE_BUFFERS_BUILD
+// TODO(crbug.com/351564777): Remove this and convert code to safer constructs.
+#pragma allow_unsafe_buffers
+#endif
+
+namespace blink {
+
+namespace {
+
+// Every allocation is prefixed with its size, so that it can be subtracted
+// from the total when freed. The prefix keeps the alignment of the block
+// returned by PartitionAlloc.
+constexpr size_t kHeaderSize = alignof(std::max_align_t);
+static_assert(kHeaderSize >= sizeof(size_t));
+
+constexpr char kTypeName[] = "JXLImageDecoder";
+
+}  // namespace
+
+JXLMemoryManager::JXLMemoryManager(size_t limit_bytes)
+    : limit_bytes_(limit_bytes),
+      memory_manager_{this, &JXLMemoryManager::Alloc,
+                      &JXLMemoryManager::Free} {}
+
+JXLMemoryManager::~JXLMemoryManager() {
+  DCHECK_EQ(0u, allocated_bytes());
+}
+
+// static
+void* JXLMemoryManager::Alloc(void* opaque, size_t size) {
+  auto* self = static_cast<JXLMemoryManager*>(opaque);
+
+  base::CheckedNumeric<size_t> block_size = size;
+  block_size += kHeaderSize;
+  if (!block_size.IsValid()) {
+    return nullptr;
+  }
+
+  const size_t limit_bytes = self->limit_bytes();
+  size_t allocated = self->allocated_bytes_.load(std::memory_order_relaxed);
+  size_t new_allocated;
+  do {
+    if (!base::CheckAdd(allocated, size).AssignIfValid(&new_allocated) ||
+        new_allocated > limit_bytes) {
+      self->limit_exceeded_.store(true, std::memory_order_relaxed);
+      return nullptr;
+    }
+  } while (!self->allocated_bytes_.compare_exchange_weak(
+      allocated, new_allocated, std::memory_order_relaxed));
+
+  void* block = WTF::Partitions::BufferTryRealloc(
+      nullptr, block_size.ValueOrDie(), kTypeName);
+  if (!block) {
+    self->allocated_bytes_.fetch_sub(size, std::memory_order_relaxed);
+    return nullptr;
+  }
+  memcpy(block, &size, sizeof(size));
+  return static_cast<uint8_t*>(block) + kHeaderSize;
+}
+
+// static
+void JXLMemoryManager::Free(void* opaque, void* address) {
+  if (!address) {
+    return;
+  }
+  auto* self = static_cast<JXLMemoryManager*>(opaque);
+  uint8_t* block = static_cast<uint8_t*>(address) - kHeaderSize;
+  size_t size;
+  memcpy(&size, block, sizeof(size));
+  DCHECK_GE(self->allocated_bytes(), size);
+  self->allocated_bytes_.fetch_sub(size, std::memory_order_relaxed);
+  WTF::Partitions::BufferFree(block);
+}
+
+}  // namespace blink
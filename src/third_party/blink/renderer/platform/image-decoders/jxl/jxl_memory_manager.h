@@ -0,0 +1,71 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_MEMORY_MANAGER_H_
+#define THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_MEMORY_MANAGER_H_
+
+#include <stddef.h>
+
+#include <atomic>
+
+#include "third_party/blink/renderer/platform/platform_export.h"
+
+#include "third_party/libjxl/src/lib/include/jxl/memory_manager.h"
+
+namespace blink {
+
+// Routes the allocations libjxl makes through its JxlMemoryManager through
+// PartitionAlloc, so that they show up in memory-infra, and keeps track of
+// the bytes allocated on behalf of a single image decoder. Allocations that
+// would take the total above `limit_bytes` fail, which makes libjxl report a
+// decoding error.
+//
+// libjxl 0.10 only allocates the decoder object and some of its bookkeeping
+// this way. Image planes and group buffers come from its own aligned
+// allocator, which is neither routed nor counted. JXLImageDecoder checks the
+// size of the planes of each frame against a limit of its own instead.
+//
+// libjxl may allocate from the threads of its parallel runner, so the
+// accounting is thread-safe.
+class PLATFORM_EXPORT JXLMemoryManager {
+ public:
+  explicit JXLMemoryManager(size_t limit_bytes);
+  JXLMemoryManager(const JXLMemoryManager&) = delete;
+  JXLMemoryManager& operator=(const JXLMemoryManager&) = delete;
+  ~JXLMemoryManager();
+
+  // To be passed to JxlDecoderMake. This object must outlive the decoders
+  // created with it.
+  const JxlMemoryManager* get() const { return &memory_manager_; }
+
+  // Changes the limit for future allocations. Does not free anything if the
+  // new limit is below the bytes already allocated.
+  void set_limit_bytes(size_t limit_bytes) {
+    limit_bytes_.store(limit_bytes, std::memory_order_relaxed);
+  }
+  size_t limit_bytes() const {
+    return limit_bytes_.load(std::memory_order_relaxed);
+  }
+
+  size_t allocated_bytes() const {
+    return allocated_bytes_.load(std::memory_order_relaxed);
+  }
+  // Whether an allocation was refused because of the limit.
+  bool limit_exceeded() const {
+    return limit_exceeded_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static void* Alloc(void* opaque, size_t size);
+  static void Free(void* opaque, void* address);
+
+  std::atomic<size_t> limit_bytes_;
+  std::atomic<size_t> allocated_bytes_{0};
+  std::atomic<bool> limit_exceeded_{false};
+  JxlMemoryManager memory_manager_;
+};
+
+}  // namespace blink
+
+#endif  // THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_MEMORY_MANAGER_H_
@@ -0,0 +1,130 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_parallel_runner.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "base/check_op.h"
+#include "base/functional/bind.h"
+#include "base/memory/raw_ptr.h"
+#include "base/system/sys_info.h"
+#include "base/task/post_job.h"
+#include "base/task/task_traits.h"
+#include "base/task/thread_pool/thread_pool_instance.h"
+
+namespace blink {
+
+namespace {
+
+// Size in pixels of the square groups libjxl splits an image into. A group is
+// the unit of work handed to the parallel runner.
+constexpr uint32_t kGroupDim = 256;
+
+// Images with fewer pixels than this are decoded on the calling thread, the
+// cost of waking up workers outweighs what they would save.
+constexpr uint64_t kMinPixelsForParallelDecode = 512 * 512;
+
+// Upper bound on the number of threads used by a single decode, so that a
+// page full of large images does not starve the rest of the thread pool.
+constexpr size_t kMaxThreads = 8;
+
+// State shared by the workers of a single Run() call. It lives on the stack
+// of Run(), which joins the job before returning.
+struct RunState {
+  raw_ptr<void> jpegxl_opaque;
+  JxlParallelRunFunction func;
+  uint32_t end_range;
+  size_t num_threads;
+  std::atomic<uint32_t> next_value;
+};
+
+void RunWorker(RunState* state, base::JobDelegate* delegate) {
+  const size_t thread_id = delegate->GetTaskId();
+  DCHECK_LT(thread_id, state->num_threads);
+  // The job is joined, so every value has to be processed before Run()
+  // returns: yielding would only hand the remaining values to the joining
+  // thread.
+  for (;;) {
+    const uint32_t value =
+        state->next_value.fetch_add(1, std::memory_order_relaxed);
+    if (value >= state->end_range) {
+      return;
+    }
+    state->func(state->jpegxl_opaque.get(), value, thread_id);
+  }
+}
+
+size_t GetMaxConcurrency(const RunState* state, size_t worker_count) {
+  const uint32_t next_value =
+      state->next_value.load(std::memory_order_relaxed);
+  const size_t remaining =
+      next_value < state->end_range ? state->end_range - next_value : 0;
+  return std::min(state->num_threads, worker_count + remaining);
+}
+
+}  // namespace
+
+// static
+size_t JXLParallelRunner::NumThreadsForImageSize(uint32_t xsize,
+                                                 uint32_t ysize) {
+  if (static_cast<uint64_t>(xsize) * ysize < kMinPixelsForParallelDecode) {
+    return 1;
+  }
+  const uint64_t num_groups =
+      static_cast<uint64_t>((xsize + kGroupDim - 1) / kGroupDim) *
+      ((ysize + kGroupDim - 1) / kGroupDim);
+  const size_t num_processors =
+      static_cast<size_t>(std::max(base::SysInfo::NumberOfProcessors(), 1));
+  return static_cast<size_t>(std::min<uint64_t>(
+      num_groups, std::min(num_processors, kMaxThreads)));
+}
+
+// static
+JxlParallelRetCode JXLParallelRunner::Run(void* runner_opaque,
+                                          void* jpegxl_opaque,
+                                          JxlParallelRunInit init,
+                                          JxlParallelRunFunction func,
+                                          uint32_t start_range,
+                                          uint32_t end_range) {
+  if (start_range > end_range) {
+    return JXL_PARALLEL_RET_RUNNER_ERROR;
+  }
+  if (start_range == end_range) {
+    return JXL_PARALLEL_RET_SUCCESS;
+  }
+
+  const JXLParallelRunner* runner =
+      static_cast<const JXLParallelRunner*>(runner_opaque);
+  size_t num_threads =
+      std::min<size_t>(runner->num_threads_, end_range - start_range);
+  if (!base::ThreadPoolInstance::Get()) {
+    num_threads = 1;
+  }
+  num_threads = std::max<size_t>(num_threads, 1);
+
+  if (init(jpegxl_opaque, num_threads) != 0) {
+    return JXL_PARALLEL_RET_RUNNER_ERROR;
+  }
+
+  if (num_threads == 1) {
+    for (uint32_t value = start_range; value < end_range; ++value) {
+      func(jpegxl_opaque, value, 0);
+    }
+    return JXL_PARALLEL_RET_SUCCESS;
+  }
+
+  RunState state{jpegxl_opaque, func, end_range, num_threads, start_range};
+  // The calling thread takes part in the job through Join(), and only returns
+  // once every value has been processed.
+  base::PostJob(FROM_HERE, {base::TaskPriority::USER_VISIBLE},
+                base::BindRepeating(&RunWorker, base::Unretained(&state)),
+                base::BindRepeating(&GetMaxConcurrency,
+                                    base::Unretained(&state)))
+      .Join();
+  return JXL_PARALLEL_RET_SUCCESS;
+}
+
+}  // namespace blink
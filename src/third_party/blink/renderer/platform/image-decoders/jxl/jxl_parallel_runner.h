@@ -0,0 +1,53 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_PARALLEL_RUNNER_H_
+#define THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_PARALLEL_RUNNER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "third_party/blink/renderer/platform/platform_export.h"
+
+#include "third_party/libjxl/src/lib/include/jxl/parallel_runner.h"
+
+namespace blink {
+
+// Implements libjxl's JxlParallelRunner interface on top of the base thread
+// pool, so that libjxl can process the independent groups of an image
+// concurrently. With a single thread, all work runs synchronously on the
+// calling thread. The output of libjxl does not depend on the number of
+// threads used.
+class PLATFORM_EXPORT JXLParallelRunner {
+ public:
+  JXLParallelRunner() = default;
+  JXLParallelRunner(const JXLParallelRunner&) = delete;
+  JXLParallelRunner& operator=(const JXLParallelRunner&) = delete;
+  ~JXLParallelRunner() = default;
+
+  // Returns the number of threads worth using to decode an image of the given
+  // size: at most one per 256x256 group, capped by the number of processors.
+  // Small images always use a single thread.
+  static size_t NumThreadsForImageSize(uint32_t xsize, uint32_t ysize);
+
+  void set_num_threads(size_t num_threads) { num_threads_ = num_threads; }
+  size_t num_threads() const { return num_threads_; }
+
+  // The JxlParallelRunner callback. Must be passed to
+  // JxlDecoderSetParallelRunner together with a pointer to this object as
+  // `runner_opaque`.
+  static JxlParallelRetCode Run(void* runner_opaque,
+                                void* jpegxl_opaque,
+                                JxlParallelRunInit init,
+                                JxlParallelRunFunction func,
+                                uint32_t start_range,
+                                uint32_t end_range);
+
+ private:
+  size_t num_threads_ = 1;
+};
+
+}  // namespace blink
+
+#endif  // THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_PARALLEL_RUNNER_H_
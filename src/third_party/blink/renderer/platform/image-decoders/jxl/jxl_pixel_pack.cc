@@ -0,0 +1,234 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "third_party/blink/renderer/platform/image-decoders/jxl/jxl_pixel_pack.h"
+
+#include <stdint.h>
+
+#include "third_party/highway/src/hwy/highway.h"
+
+#ifdef UNSAFE_BUFFERS_BUILD
+// TODO(crbug.com/351564777): Remove this and convert code to safer constructs.
+#pragma allow_unsafe_buffers
+#endif
+
+HWY_BEFORE_NAMESPACE();
+namespace blink {
+namespace HWY_NAMESPACE {
+namespace {
+
+namespace hn = hwy::HWY_NAMESPACE;
+
+// Calls `func` with `d` and the index of every group of Lanes(d) pixels of
+// the row, then with a single lane descriptor for the pixels left over.
+template <class D, class Func>
+HWY_INLINE void ForEachPixelGroup(D d, size_t num_pixels, const Func& func) {
+  const size_t lanes = hn::Lanes(d);
+  size_t i = 0;
+  for (; i + lanes <= num_pixels; i += lanes) {
+    func(d, i);
+  }
+  const hn::CappedTag<hn::TFromD<D>, 1> d1;
+  for (; i < num_pixels; ++i) {
+    func(d1, i);
+  }
+}
+
+// Returns x * a / 255, rounded, for 8-bit values widened to 16 bits.
+template <class D16, class V16>
+HWY_INLINE V16 MulDiv255(D16 d16, V16 x, V16 a) {
+  const V16 product = hn::Add(hn::Mul(x, a), hn::Set(d16, 128));
+  return hn::ShiftRight<8>(hn::Add(product, hn::ShiftRight<8>(product)));
+}
+
+// Loads the pixels at `src`, with `opaque` alpha if they have none.
+template <size_t kChannels, class D, class V>
+HWY_INLINE void LoadRGBA(D d,
+                         const hn::TFromD<D>* src,
+                         hn::TFromD<D> opaque,
+                         V& r,
+                         V& g,
+                         V& b,
+                         V& a) {
+  if constexpr (kChannels == 4) {
+    hn::LoadInterleaved4(d, src, r, g, b, a);
+  } else {
+    hn::LoadInterleaved3(d, src, r, g, b);
+    a = hn::Set(d, opaque);
+  }
+}
+
+template <bool kSwapRB, class D, class V>
+HWY_INLINE void StoreRGBA(D d, V r, V g, V b, V a, hn::TFromD<D>* dst) {
+  if constexpr (kSwapRB) {
+    hn::StoreInterleaved4(b, g, r, a, d, dst);
+  } else {
+    hn::StoreInterleaved4(r, g, b, a, d, dst);
+  }
+}
+
+template <size_t kChannels, bool kPremultiply, bool kSwapRB>
+void PackU8ToN32(const void* src_pixels, void* dst_pixels, size_t num_pixels) {
+  const uint8_t* src = static_cast<const uint8_t*>(src_pixels);
+  uint8_t* dst = static_cast<uint8_t*>(dst_pixels);
+  // Premultiplying needs 16 bits, so the 8-bit vectors are half wide.
+  const hn::ScalableTag<uint16_t> d;
+  ForEachPixelGroup(d, num_pixels, [&](auto d16, size_t i) HWY_ATTR {
+    const hn::Rebind<uint8_t, decltype(d16)> d8;
+    hn::Vec<decltype(d8)> r, g, b, a;
+    LoadRGBA<kChannels>(d8, src + i * kChannels, uint8_t{255}, r, g, b, a);
+    if constexpr (kPremultiply) {
+      const auto a16 = hn::PromoteTo(d16, a);
+      r = hn::DemoteTo(d8, MulDiv255(d16, hn::PromoteTo(d16, r), a16));
+      g = hn::DemoteTo(d8, MulDiv255(d16, hn::PromoteTo(d16, g), a16));
+      b = hn::DemoteTo(d8, MulDiv255(d16, hn::PromoteTo(d16, b), a16));
+    }
+    StoreRGBA<kSwapRB>(d8, r, g, b, a, dst + i * 4);
+  });
+}
+
+void PackGrayToN32(const void* src_pixels,
+                   void* dst_pixels,
+                   size_t num_pixels) {
+  const uint8_t* src = static_cast<const uint8_t*>(src_pixels);
+  uint8_t* dst = static_cast<uint8_t*>(dst_pixels);
+  const hn::ScalableTag<uint8_t> d;
+  ForEachPixelGroup(d, num_pixels, [&](auto d8, size_t i) HWY_ATTR {
+    const auto gray = hn::LoadU(d8, src + i);
+    StoreRGBA<false>(d8, gray, gray, gray, hn::Set(d8, uint8_t{255}),
+                     dst + i * 4);
+  });
+}
+
+template <size_t kChannels, bool kPremultiply, bool kSwapRB>
+void PackF32ToN32(const void* src_pixels, void* dst_pixels, size_t num_pixels) {
+  const float* src = static_cast<const float*>(src_pixels);
+  uint8_t* dst = static_cast<uint8_t*>(dst_pixels);
+  const hn::ScalableTag<float> d;
+  ForEachPixelGroup(d, num_pixels, [&](auto df, size_t i) HWY_ATTR {
+    const hn::Rebind<uint8_t, decltype(df)> d8;
+    const auto zero = hn::Zero(df);
+    const auto one = hn::Set(df, 1.0f);
+    const auto max = hn::Set(df, 255.0f);
+    const auto to_u8 = [&](auto v) HWY_ATTR {
+      v = hn::Mul(hn::Min(hn::Max(v, zero), one), max);
+      return hn::DemoteTo(d8, hn::NearestInt(v));
+    };
+    hn::Vec<decltype(df)> r, g, b, a;
+    LoadRGBA<kChannels>(df, src + i * kChannels, 1.0f, r, g, b, a);
+    if constexpr (kPremultiply) {
+      r = hn::Mul(r, a);
+      g = hn::Mul(g, a);
+      b = hn::Mul(b, a);
+    }
+    StoreRGBA<kSwapRB>(d8, to_u8(r), to_u8(g), to_u8(b), to_u8(a),
+                       dst + i * 4);
+  });
+}
+
+// Half floats are loaded and stored as their bits, which every target can
+// interleave.
+void PremultiplyF16(const void* src_pixels,
+                    void* dst_pixels,
+                    size_t num_pixels) {
+  const uint16_t* src = static_cast<const uint16_t*>(src_pixels);
+  uint16_t* dst = static_cast<uint16_t*>(dst_pixels);
+  const hn::ScalableTag<float> d;
+  ForEachPixelGroup(d, num_pixels, [&](auto df, size_t i) HWY_ATTR {
+    const hn::Rebind<uint16_t, decltype(df)> d16;
+    const hn::Rebind<hwy::float16_t, decltype(df)> dh;
+    hn::Vec<decltype(d16)> r, g, b, a;
+    hn::LoadInterleaved4(d16, src + i * 4, r, g, b, a);
+    const auto alpha = hn::PromoteTo(df, hn::BitCast(dh, a));
+    const auto premultiply = [&](auto v) HWY_ATTR {
+      const auto product =
+          hn::Mul(hn::PromoteTo(df, hn::BitCast(dh, v)), alpha);
+      return hn::BitCast(d16, hn::DemoteTo(dh, product));
+    };
+    StoreRGBA<false>(d16, premultiply(r), premultiply(g), premultiply(b),
+                     a, dst + i * 4);
+  });
+}
+
+void ExpandF16RGB(const void* src_pixels, void* dst_pixels, size_t num_pixels) {
+  const uint16_t* src = static_cast<const uint16_t*>(src_pixels);
+  uint16_t* dst = static_cast<uint16_t*>(dst_pixels);
+  // The bits of 1.0 as a half float.
+  constexpr uint16_t kHalfOne = 0x3C00;
+  const hn::ScalableTag<uint16_t> d;
+  ForEachPixelGroup(d, num_pixels, [&](auto d16, size_t i) HWY_ATTR {
+    hn::Vec<decltype(d16)> r, g, b, a;
+    LoadRGBA<3>(d16, src + i * 3, kHalfOne, r, g, b, a);
+    StoreRGBA<false>(d16, r, g, b, a, dst + i * 4);
+  });
+}
+
+}  // namespace
+}  // namespace HWY_NAMESPACE
+}  // namespace blink
+HWY_AFTER_NAMESPACE();
+
+namespace blink {
+
+JXLPackRowFunction GetJXLPackRowFunction(skcms_PixelFormat src_format,
+                                         skcms_PixelFormat dst_format,
+                                         bool premultiply) {
+  namespace target = HWY_NAMESPACE;
+  const bool to_rgba = dst_format == skcms_PixelFormat_RGBA_8888;
+  const bool to_bgra = dst_format == skcms_PixelFormat_BGRA_8888;
+  // Pixels without alpha are opaque, and premultiplying leaves them as is.
+  switch (src_format) {
+    case skcms_PixelFormat_RGBA_8888:
+      if (to_rgba) {
+        return premultiply ? &target::PackU8ToN32<4, true, false> : nullptr;
+      }
+      if (to_bgra) {
+        return premultiply ? &target::PackU8ToN32<4, true, true>
+                           : &target::PackU8ToN32<4, false, true>;
+      }
+      break;
+    case skcms_PixelFormat_RGB_888:
+      if (to_rgba || to_bgra) {
+        return to_rgba ? &target::PackU8ToN32<3, false, false>
+                       : &target::PackU8ToN32<3, false, true>;
+      }
+      break;
+    case skcms_PixelFormat_G_8:
+      if (to_rgba || to_bgra) {
+        return &target::PackGrayToN32;
+      }
+      break;
+    case skcms_PixelFormat_RGBA_ffff:
+      if (to_rgba) {
+        return premultiply ? &target::PackF32ToN32<4, true, false>
+                           : &target::PackF32ToN32<4, false, false>;
+      }
+      if (to_bgra) {
+        return premultiply ? &target::PackF32ToN32<4, true, true>
+                           : &target::PackF32ToN32<4, false, true>;
+      }
+      break;
+    case skcms_PixelFormat_RGB_fff:
+      if (to_rgba || to_bgra) {
+        return to_rgba ? &target::PackF32ToN32<3, false, false>
+                       : &target::PackF32ToN32<3, false, true>;
+      }
+      break;
+    case skcms_PixelFormat_RGBA_hhhh:
+      if (dst_format == skcms_PixelFormat_RGBA_hhhh && premultiply) {
+        return &target::PremultiplyF16;
+      }
+      break;
+    case skcms_PixelFormat_RGB_hhh:
+      if (dst_format == skcms_PixelFormat_RGBA_hhhh) {
+        return &target::ExpandF16RGB;
+      }
+      break;
+    default:
+      break;
+  }
+  return nullptr;
+}
+
+}  // namespace blink
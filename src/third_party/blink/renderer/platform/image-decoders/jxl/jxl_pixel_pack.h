@@ -0,0 +1,33 @@
+// Copyright 2026 The Chromium Authors and Alex313031
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_PIXEL_PACK_H_
+#define THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_PIXEL_PACK_H_
+
+#include <stddef.h>
+
+#include "third_party/blink/renderer/platform/platform_export.h"
+#include "third_party/skia/modules/skcms/skcms.h"
+
+namespace blink {
+
+// Converts `num_pixels` pixels from libjxl at `src` to the pixels of a frame
+// at `dst`.
+using JXLPackRowFunction = void (*)(const void* src,
+                                    void* dst,
+                                    size_t num_pixels);
+
+// Returns a vectorized function that narrows, premultiplies if `premultiply`,
+// adds opaque alpha to RGB and gray pixels and reorders pixels of
+// `src_format` into `dst_format`, for the frames that need no color
+// conversion. skcms_Transform handles these too, but one step at a time.
+// Returns nullptr for other combinations, and for those a plain copy handles.
+PLATFORM_EXPORT JXLPackRowFunction
+GetJXLPackRowFunction(skcms_PixelFormat src_format,
+                      skcms_PixelFormat dst_format,
+                      bool premultiply);
+
+}  // namespace blink
+
+#endif  // THIRD_PARTY_BLINK_RENDERER_PLATFORM_IMAGE_DECODERS_JXL_JXL_PIXEL_PACK_H_